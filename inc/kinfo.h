@@ -0,0 +1,63 @@
+#ifndef JOS_INC_KINFO_H
+#define JOS_INC_KINFO_H
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+
+// The kernel info page is a single page of kernel-maintained data that is
+// mapped read-only into every environment at UKINFO, so that user code can
+// read the time and its own identity without entering the kernel.
+//
+// The kernel updates the page under a sequence lock: ki_seq is odd while
+// an update is in progress.  Readers sample ki_seq, copy the fields they
+// need, and retry if ki_seq changed or was odd (see kinfo_read_begin and
+// kinfo_read_retry below).
+
+#define KINFO_MAGIC	0x4B494E46	// "KINF"
+#define KINFO_NCPU	8		// Per-CPU slots; see ki_cpus
+
+struct KernInfo {
+	uint32_t ki_magic;		// KINFO_MAGIC once the page is valid
+	volatile uint32_t ki_seq;	// Sequence lock; odd while updating
+
+	uint64_t ki_ticks;		// Clock ticks since boot
+	uint32_t ki_tick_hz;		// Ticks per second (0 if no clock yet)
+
+	uint64_t ki_tsc_boot;		// TSC value at kernel boot
+	uint32_t ki_tsc_khz;		// TSC frequency (0 if uncalibrated)
+
+	uint32_t ki_ncpu;		// Number of running CPUs
+
+	// Indexed by local APIC ID, which user code can read with cpuid
+	// (leaf 1, %ebx bits 31-24).  An environment can be moved to
+	// another CPU between that and reading its slot, so treat the
+	// answer as a hint, or confirm it with a system call.
+	struct {
+		int32_t kc_envid;	// Env running on this CPU, or 0
+	} ki_cpus[KINFO_NCPU];
+};
+
+static inline uint32_t
+kinfo_read_begin(const volatile struct KernInfo *ki)
+{
+	uint32_t seq;
+
+	while ((seq = ki->ki_seq) & 1)
+		asm volatile("pause");
+	asm volatile("" ::: "memory");
+	return seq;
+}
+
+static inline bool
+kinfo_read_retry(const volatile struct KernInfo *ki, uint32_t seq)
+{
+	asm volatile("" ::: "memory");
+	return ki->ki_seq != seq;
+}
+
+// There is no user library in this tree yet.  When there is, its
+// readers should check ki_magic first and fall back to the equivalent
+// system call (sys_getenvid, sys_time_msec) when the page is not valid
+// or the field they need is still zero.
+
+#endif /* !JOS_INC_KINFO_H */
@@ -1,31 +1,75 @@
 #ifndef JOS_INC_STDIO_H
 #define JOS_INC_STDIO_H
 
+#include <inc/types.h>
 #include <inc/stdarg.h>
 
 #ifndef NULL
 #define NULL	((void *) 0)
 #endif /* !NULL */
 
+// A format string parsed once into a list of directives, each a run of
+// literal text followed by one conversion (conv is 0 for the last run).
+#define PRINTFMT_MAXDIRS	12
+
+struct printfmt_dir {
+	const char *lit;
+	uint16_t litlen;
+	char conv;
+	char padc;
+	uint8_t lflag;
+	uint8_t altflag;
+	int width;
+	int precision;
+};
+
+struct printfmt_prog {
+	const char *fmt;	// Format compiled into dirs, or NULL
+	int ndirs;		// Directives in use, -1 if not compilable
+	struct printfmt_dir dirs[PRINTFMT_MAXDIRS];
+};
+
 // lib/console.c
 void	cputchar(int c);
+void	cwrite(const char *buf, size_t len);
 int	getchar(void);
 int	iscons(int fd);
 
 // lib/printfmt.c
-void	printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
-void	vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list);
-int	snprintf(char *str, int size, const char *fmt, ...);
-int	vsnprintf(char *str, int size, const char *fmt, va_list);
+void	printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...)
+	    __attribute__((format(printf, 3, 4)));
+void	vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list)
+	    __attribute__((format(printf, 3, 0)));
+void	vwprintfmt(void (*write)(const char *, size_t, void*), void *putdat, const char *fmt, va_list)
+	    __attribute__((format(printf, 3, 0)));
+int	printfmt_compile(struct printfmt_prog *prog, const char *fmt);
+void	vwprintfmt_prog(void (*write)(const char *, size_t, void*), void *putdat,
+			const struct printfmt_prog *prog, va_list);
+const char *strerror(int err);
+int	snprintf(char *str, int size, const char *fmt, ...)
+	    __attribute__((format(printf, 3, 4)));
+int	vsnprintf(char *str, int size, const char *fmt, va_list)
+	    __attribute__((format(printf, 3, 0)));
 
 // lib/printf.c
-int	cprintf(const char *fmt, ...);
-int	vcprintf(const char *fmt, va_list);
+int	cprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+int	vcprintf(const char *fmt, va_list) __attribute__((format(printf, 1, 0)));
+int	cprintf_prog(struct printfmt_prog *prog, const char *fmt, ...)
+	    __attribute__((format(printf, 2, 3)));
+
+// cprintf whose constant format is parsed only on the first call made
+// from each call site.  A format printfmt_compile() cannot take is
+// reported once and then printed by cprintf as usual.
+#define cprintf_fast(fmt, ...)						\
+	({								\
+		static struct printfmt_prog __prog;			\
+		cprintf_prog(&__prog, fmt, ##__VA_ARGS__);		\
+	})
 
 // lib/fprintf.c
-int	printf(const char *fmt, ...);
-int	fprintf(int fd, const char *fmt, ...);
-int	vfprintf(int fd, const char *fmt, va_list);
+int	printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+int	fprintf(int fd, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int	vfprintf(int fd, const char *fmt, va_list) __attribute__((format(printf, 2, 0)));
 
 // lib/readline.c
 char*	readline(const char *prompt);
@@ -20,6 +20,17 @@ void *	memmove(void *dst, const void *src, size_t len);
 int	memcmp(const void *s1, const void *s2, size_t len);
 void *	memfind(const void *s, int c, size_t len);
 
+void	clear_page(void *pg);
+void	copy_page(void *dst, const void *src);
+
+// Features string_init may enable for the routines above.
+#define STRING_SSE2	0x01	// 16-byte SSE2 loads and stores
+#define STRING_ERMS	0x02	// Fast "rep movsb"/"rep stosb" for big blocks
+#define STRING_NTI	0x04	// movnti non-temporal stores (CPU has SSE2)
+
+uint32_t string_init(uint32_t allow);
+uint32_t string_features(void);
+
 long	strtol(const char *s, char **endptr, int base);
 
 #endif /* not JOS_INC_STRING_H */
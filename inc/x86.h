@@ -240,6 +240,25 @@ cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *e
 		*edxp = edx;
 }
 
+// cpuid for leaves that take a subleaf in %ecx.
+static inline void
+cpuid_count(uint32_t info, uint32_t subleaf, uint32_t *eaxp, uint32_t *ebxp,
+	    uint32_t *ecxp, uint32_t *edxp)
+{
+	uint32_t eax, ebx, ecx, edx;
+	asm volatile("cpuid"
+		     : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+		     : "a" (info), "c" (subleaf));
+	if (eaxp)
+		*eaxp = eax;
+	if (ebxp)
+		*ebxp = ebx;
+	if (ecxp)
+		*ecxp = ecx;
+	if (edxp)
+		*edxp = edx;
+}
+
 static inline uint64_t
 read_tsc(void)
 {
@@ -248,6 +267,29 @@ read_tsc(void)
 	return tsc;
 }
 
+static inline uint64_t
+rdmsr(uint32_t msr)
+{
+	uint64_t val;
+	asm volatile("rdmsr" : "=A" (val) : "c" (msr));
+	return val;
+}
+
+static inline void
+wrmsr(uint32_t msr, uint64_t val)
+{
+	asm volatile("wrmsr" : : "c" (msr), "A" (val));
+}
+
+// Read performance counter 'ctr'; set bit 30 to select a fixed counter.
+static inline uint64_t
+rdpmc(uint32_t ctr)
+{
+	uint64_t val;
+	asm volatile("rdpmc" : "=A" (val) : "c" (ctr));
+	return val;
+}
+
 static inline uint32_t
 xchg(volatile uint32_t *addr, uint32_t newval)
 {
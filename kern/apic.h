@@ -0,0 +1,32 @@
+#ifndef JOS_KERN_APIC_H
+#define JOS_KERN_APIC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+
+// Where kern/entrypgdir.c maps the interrupt controllers.
+#define LAPIC_VA	(MMIOBASE)
+#define IOAPIC_VA	(MMIOBASE + PGSIZE)
+
+// Hardware IRQ numbers are delivered at IRQ_OFFSET + irq.
+#define IRQ_OFFSET	32
+#define IRQ_SPURIOUS	7
+#define IRQ_ERROR	19
+
+#define MAX_IOAPIC_IRQS	24
+
+extern bool lapic_present;
+
+void lapic_init(void);
+int lapic_id(void);
+void lapic_eoi(void);
+
+void ioapic_init(void);
+int ioapic_route(int irq, int apicid);
+void ioapic_mask(int irq);
+int irq_affinity(int irq);
+
+#endif	// !JOS_KERN_APIC_H
@@ -0,0 +1,670 @@
+// Micro-benchmarks for library routines, timed with the TSC.
+
+#include <inc/stdio.h>
+#include <inc/stdarg.h>
+#include <inc/string.h>
+#include <inc/error.h>
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/memlayout.h>
+
+#include <kern/monitor.h>
+#include <kern/kdebug.h>
+
+#define NVALUES		64	// Distinct inputs per pass
+#define NPASSES		256	// Passes over the inputs per measurement
+
+struct Bench {
+	const char *name;
+	const char *desc;
+	void (*func)(void);
+};
+
+static uint32_t bench_seed = 1;
+
+// Results of timed calls end up here so they cannot be optimized away.
+static volatile uintptr_t bench_sink;
+
+// Small deterministic generator so runs are comparable.
+static uint32_t
+bench_rand(void)
+{
+	bench_seed = bench_seed * 1103515245 + 12345;
+	return bench_seed;
+}
+
+/*
+ * Integer formatting.  Times snprintf with its digit-pair conversion
+ * against the recursive printnum that lib/printfmt.c used to have,
+ * which divided an unsigned long long once per digit and handed each
+ * digit to snprintf's putch.  The old conversion is reproduced here,
+ * writing through a putch just as the old snprintf did, but without
+ * parsing a format, so its column slightly flatters it.
+ */
+
+struct refbuf {
+	char *buf;
+	char *ebuf;
+};
+
+static void
+ref_putch(int ch, struct refbuf *b)
+{
+	if (b->buf < b->ebuf)
+		*b->buf++ = ch;
+}
+
+static void
+printnum_reference(void (*putch)(int, struct refbuf *), struct refbuf *b,
+		   unsigned long long num, unsigned base, int width, int padc)
+{
+	// first recursively print all preceding (more significant) digits
+	if (num >= base)
+		printnum_reference(putch, b, num / base, base, width - 1, padc);
+	else
+		// print any needed pad characters before first digit
+		while (--width > 0)
+			putch(padc, b);
+
+	// then print this (the least significant) digit
+	putch("0123456789abcdef"[num % base], b);
+}
+
+static uint32_t
+time_snprintf(const char *fmt, bool wide, const unsigned long long *values)
+{
+	char buf[32];
+	uint64_t start;
+	int j, k;
+
+	start = read_tsc();
+	for (k = 0; k < NPASSES; k++)
+		for (j = 0; j < NVALUES; j++)
+			if (wide)
+				snprintf(buf, sizeof(buf), fmt, values[j]);
+			else
+				snprintf(buf, sizeof(buf), fmt, (uint32_t) values[j]);
+	return (read_tsc() - start) / (NPASSES * NVALUES);
+}
+
+static uint32_t
+time_reference(unsigned base, bool wide, const unsigned long long *values)
+{
+	char buf[32];
+	struct refbuf b;
+	uint64_t start;
+	int j, k;
+
+	start = read_tsc();
+	for (k = 0; k < NPASSES; k++)
+		for (j = 0; j < NVALUES; j++) {
+			b.buf = buf;
+			b.ebuf = buf + sizeof(buf) - 1;
+			printnum_reference(ref_putch, &b, wide ? values[j]
+					   : (uint32_t) values[j], base, -1, ' ');
+			*b.buf = 0;
+		}
+	return (read_tsc() - start) / (NPASSES * NVALUES);
+}
+
+static void
+bench_printnum(void)
+{
+	static const struct {
+		const char *fmt;
+		unsigned base;
+		bool wide;
+	} fmts[] = {
+		{ "%u", 10, 0 },
+		{ "%x", 16, 0 },
+		{ "%llu", 10, 1 },
+		{ "%llx", 16, 1 },
+	};
+	unsigned long long values[NVALUES];
+	uint32_t fast, ref;
+	int i, j;
+
+	cprintf("format   snprintf  recursive  (cycles per conversion)\n");
+	for (i = 0; i < ARRAY_SIZE(fmts); i++) {
+		for (j = 0; j < NVALUES; j++) {
+			values[j] = bench_rand() >> (j % 32);
+			if (fmts[i].wide)
+				values[j] = (values[j] << 32) | bench_rand();
+		}
+
+		fast = time_snprintf(fmts[i].fmt, fmts[i].wide, values);
+		ref = time_reference(fmts[i].base, fmts[i].wide, values);
+
+		cprintf("%6s %10u %10u\n", fmts[i].fmt, fast, ref);
+	}
+}
+
+/*
+ * Format parsing.  Prints a typical log line to a sink that discards
+ * it, once parsing the format on every call and once through a
+ * format compiled ahead of time with printfmt_compile.
+ */
+
+static void
+null_write(const char *buf, size_t len, void *putdat)
+{
+}
+
+static void
+fmt_parsed(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vwprintfmt(null_write, NULL, fmt, ap);
+	va_end(ap);
+}
+
+static void
+fmt_compiled(const struct printfmt_prog *prog, ...)
+{
+	va_list ap;
+
+	va_start(ap, prog);
+	vwprintfmt_prog(null_write, NULL, prog, ap);
+	va_end(ap);
+}
+
+static void
+bench_printfmt(void)
+{
+	static const char fmt[] = "%3d  %8u  %8u  %8u  %-8s %08x\n";
+	struct printfmt_prog prog;
+	uint64_t start, parsed, compiled;
+	int k;
+
+	printfmt_compile(&prog, fmt);
+
+	start = read_tsc();
+	for (k = 0; k < NPASSES * NVALUES; k++)
+		fmt_parsed(fmt, k, k, 2 * k, 3 * k, "name", k);
+	parsed = read_tsc() - start;
+
+	start = read_tsc();
+	for (k = 0; k < NPASSES * NVALUES; k++)
+		fmt_compiled(&prog, k, k, 2 * k, 3 * k, "name", k);
+	compiled = read_tsc() - start;
+
+	cprintf("parsed each call %6u cycles\n",
+		(uint32_t) (parsed / (NPASSES * NVALUES)));
+	cprintf("compiled         %6u cycles\n",
+		(uint32_t) (compiled / (NPASSES * NVALUES)));
+}
+
+/*
+ * Block copies and fills, 16 bytes to 1MB, for each set of features
+ * the CPU allows, and for the old routines, which used "rep movsl" only
+ * when everything was word aligned and "rep movsb" otherwise.
+ */
+
+#define COPY_MAX	(1 << 20)
+
+// Unused memory above the kernel, within the 4MB that entry_pgdir maps.
+static char *
+bench_mem(size_t n)
+{
+	extern char end[];
+	char *p = ROUNDUP((char *) end, PGSIZE);
+
+	if (p + n > (char *) (KERNBASE + PTSIZE))
+		return NULL;
+	return p;
+}
+
+static void
+old_memcpy(void *d, const void *s, size_t n)
+{
+	if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
+		asm volatile("cld; rep movsl\n"
+			:: "D" (d), "S" (s), "c" (n/4) : "cc", "memory");
+	else
+		asm volatile("cld; rep movsb\n"
+			:: "D" (d), "S" (s), "c" (n) : "cc", "memory");
+}
+
+static void
+bench_memcpy(void)
+{
+	static const struct {
+		const char *name;
+		uint32_t feat;
+	} modes[] = {
+		{ "word", 0 },
+		{ "sse2", STRING_SSE2 },
+		{ "erms", STRING_SSE2 | STRING_ERMS },
+	};
+	uint32_t orig = string_features();
+	uint64_t start, t;
+	char *src, *dst;
+	size_t n;
+	int align, i, k, iters;
+
+	if ((src = bench_mem(2 * COPY_MAX + PGSIZE)) == NULL) {
+		cprintf("not enough memory above the kernel\n");
+		return;
+	}
+	dst = src + COPY_MAX + PGSIZE;
+
+	cprintf("memcpy, cycles per copy (dst+1, src+3 when misaligned)\n");
+	cprintf("    size  align        old");
+	for (i = 0; i < ARRAY_SIZE(modes); i++)
+		if ((modes[i].feat & orig) == modes[i].feat)
+			cprintf("  %9s", modes[i].name);
+	cprintf("\n");
+
+	for (n = 16; n <= COPY_MAX; n *= 4)
+		for (align = 0; align < 2; align++) {
+			// Copy about 4MB per measurement.
+			iters = MAX(4 * COPY_MAX / n, 4);
+			if (align)
+				n -= 3;
+			cprintf("%8u  %5s", n, align ? "no" : "yes");
+
+			start = read_tsc();
+			for (k = 0; k < iters; k++)
+				old_memcpy(dst + align, src + 3 * align, n);
+			t = read_tsc() - start;
+			cprintf(" %10u", (uint32_t) (t / iters));
+
+			for (i = 0; i < ARRAY_SIZE(modes); i++) {
+				if ((modes[i].feat & orig) != modes[i].feat)
+					continue;
+				string_init(modes[i].feat);
+				start = read_tsc();
+				for (k = 0; k < iters; k++)
+					memcpy(dst + align, src + 3 * align, n);
+				t = read_tsc() - start;
+				cprintf("  %9u", (uint32_t) (t / iters));
+			}
+			string_init(orig);
+			cprintf("\n");
+			if (align)
+				n += 3;
+		}
+}
+
+/*
+ * Page copies and clears over 1MB, with ordinary and non-temporal
+ * stores, followed by a re-read of a small working set that was hot
+ * beforehand.  The re-read shows how much of it the stores evicted.
+ */
+
+#define HOT_SIZE	(16 * 1024)
+
+// Cycles to read one word from each cache line of [p, p + n).
+static uint32_t
+bench_touch(const char *p, size_t n)
+{
+	const volatile char *v = p;
+	uint64_t start = read_tsc();
+	size_t i;
+
+	for (i = 0; i < n; i += 64)
+		(void) v[i];
+	return read_tsc() - start;
+}
+
+static void
+bench_page(void)
+{
+	static const char *names[] = {
+		"memcpy", "copy_page", "memset", "clear_page"
+	};
+	char *src, *dst, *hot;
+	uint64_t start, t;
+	uint32_t hot_cycles;
+	int op, i;
+
+	if ((src = bench_mem(2 * COPY_MAX + HOT_SIZE)) == NULL) {
+		cprintf("not enough memory above the kernel\n");
+		return;
+	}
+	dst = src + COPY_MAX;
+	hot = dst + COPY_MAX;
+
+	cprintf("op          cycles/page  hot set re-read\n");
+	for (op = 0; op < ARRAY_SIZE(names); op++) {
+		bench_touch(hot, HOT_SIZE);
+		start = read_tsc();
+		for (i = 0; i < COPY_MAX; i += PGSIZE)
+			switch (op) {
+			case 0:
+				memcpy(dst + i, src + i, PGSIZE);
+				break;
+			case 1:
+				copy_page(dst + i, src + i);
+				break;
+			case 2:
+				memset(dst + i, 0, PGSIZE);
+				break;
+			case 3:
+				clear_page(dst + i);
+				break;
+			}
+		t = read_tsc() - start;
+		hot_cycles = bench_touch(hot, HOT_SIZE);
+		cprintf("%-10s  %11u  %15u\n", names[op],
+			(uint32_t) (t / (COPY_MAX / PGSIZE)), hot_cycles);
+	}
+}
+
+/*
+ * String scanning.  First checks strlen, strnlen, strchr, strfind,
+ * memcmp and memfind against byte-at-a-time references on random
+ * inputs for each feature set, placing half of them against the end
+ * of the 4MB that entry_pgdir maps, where reading past the end of a
+ * string faults.  Then times each routine over a 4KB buffer.
+ */
+
+#define SCAN_FUZZ	20000
+#define SCAN_SIZE	4096
+
+static int
+ref_strlen(const char *s)
+{
+	int n;
+
+	for (n = 0; s[n] != '\0'; n++)
+		/* do nothing */;
+	return n;
+}
+
+static int
+ref_strnlen(const char *s, size_t size)
+{
+	int n;
+
+	for (n = 0; size > 0 && s[n] != '\0'; n++, size--)
+		/* do nothing */;
+	return n;
+}
+
+static const char *
+ref_strfind(const char *s, char c)
+{
+	for (; *s; s++)
+		if (*s == c)
+			break;
+	return s;
+}
+
+static int
+ref_memcmp(const uint8_t *s1, const uint8_t *s2, size_t n)
+{
+	for (; n > 0; s1++, s2++, n--)
+		if (*s1 != *s2)
+			return (int) *s1 - (int) *s2;
+	return 0;
+}
+
+static const void *
+ref_memfind(const uint8_t *s, int c, size_t n)
+{
+	for (; n > 0; s++, n--)
+		if (*s == (uint8_t) c)
+			break;
+	return s;
+}
+
+// Random bytes, drawn from a small alphabet now and then so that
+// matches and near-matches are common.  Never zero.
+static void
+scan_fill(char *p, int n, int narrow)
+{
+	while (n-- > 0)
+		*p++ = 1 + bench_rand() % (narrow ? 3 : 255);
+}
+
+static int
+scan_fuzz(char *lo, char *top)
+{
+	char *s, *a, *b, c;
+	int i, len, fails = 0;
+	size_t n;
+
+	for (i = 0; i < SCAN_FUZZ; i++) {
+		len = bench_rand() % (i % 8 ? 64 : 1024);
+		s = (i & 1) ? top - len - 1 : lo + bench_rand() % 64;
+		scan_fill(s, len, i % 3 == 0);
+		s[len] = '\0';
+		c = i % 5 ? 1 + bench_rand() % 255 : '\0';
+		if (i % 3 == 0)
+			c = 1 + c % 3;
+		n = i % 9 ? bench_rand() % 1100 : (size_t) -1;
+
+		fails += strlen(s) != ref_strlen(s);
+		fails += strnlen(s, n) != ref_strnlen(s, n);
+		fails += strfind(s, c) != ref_strfind(s, c);
+		fails += strchr(s, c) != (*ref_strfind(s, c) ? ref_strfind(s, c) : NULL);
+
+		n = bench_rand() % 512;
+		b = top - n;
+		a = lo + 128 + bench_rand() % 64;
+		scan_fill(b, n, i % 3 == 0);
+		memmove(a, b, n);
+		if (n && i % 4)
+			a[bench_rand() % n] ^= 1 + bench_rand() % 3;
+		fails += memcmp(a, b, n) != ref_memcmp((uint8_t *) a, (uint8_t *) b, n);
+		fails += memfind(b, c, n) != ref_memfind((uint8_t *) b, c, n);
+	}
+	return fails;
+}
+
+static uintptr_t
+scan_op(int op, bool lib, const char *a, const char *b)
+{
+	switch (op) {
+	case 0:
+		return lib ? strlen(a) : ref_strlen(a);
+	case 1:
+		return lib ? strnlen(a, SCAN_SIZE) : ref_strnlen(a, SCAN_SIZE);
+	case 2:
+		return (uintptr_t) (lib ? strchr(a, 'C') : ref_strfind(a, 'C'));
+	case 3:
+		return lib ? memcmp(a, b, SCAN_SIZE)
+			: ref_memcmp((uint8_t *) a, (uint8_t *) b, SCAN_SIZE);
+	default:
+		return (uintptr_t) (lib ? memfind(a, 'C', SCAN_SIZE)
+				    : ref_memfind((uint8_t *) a, 'C', SCAN_SIZE));
+	}
+}
+
+static void
+bench_scan(void)
+{
+	static const struct {
+		const char *name;
+		uint32_t feat;
+	} modes[] = {
+		{ "word", 0 },
+		{ "sse2", STRING_SSE2 },
+	};
+	static const char *names[] = {
+		"strlen", "strnlen", "strchr", "memcmp", "memfind"
+	};
+	uint32_t orig = string_features();
+	char *lo, *top = (char *) (KERNBASE + PTSIZE);
+	char *a, *b;
+	uint64_t start, t;
+	int i, m, op, k, iters = 256;
+
+	if ((lo = bench_mem(4 * PGSIZE)) == NULL || lo + 4 * PGSIZE > top - 2 * SCAN_SIZE) {
+		cprintf("not enough memory above the kernel\n");
+		return;
+	}
+
+	for (m = 0; m < ARRAY_SIZE(modes); m++) {
+		if ((modes[m].feat & orig) != modes[m].feat)
+			continue;
+		string_init(modes[m].feat);
+		cprintf("%s: %d mismatches in %d rounds\n", modes[m].name,
+			scan_fuzz(lo, top), SCAN_FUZZ);
+	}
+	string_init(orig);
+
+	// Two equal strings of SCAN_SIZE - 1 bytes with no 'c' in them.
+	a = lo;
+	b = lo + SCAN_SIZE;
+	for (i = 0; i < SCAN_SIZE - 1; i++)
+		a[i] = b[i] = 'a' + i % 26;
+	a[i] = b[i] = '\0';
+
+	cprintf("cycles per %d bytes      byte", SCAN_SIZE);
+	for (m = 0; m < ARRAY_SIZE(modes); m++)
+		if ((modes[m].feat & orig) == modes[m].feat)
+			cprintf("  %8s", modes[m].name);
+	cprintf("\n");
+	for (op = 0; op < ARRAY_SIZE(names); op++) {
+		cprintf("%-20s", names[op]);
+		for (m = -1; m < ARRAY_SIZE(modes); m++) {
+			if (m >= 0 && (modes[m].feat & orig) != modes[m].feat)
+				continue;
+			if (m >= 0)
+				string_init(modes[m].feat);
+			start = read_tsc();
+			for (k = 0; k < iters; k++)
+				bench_sink += scan_op(op, m >= 0, a, b);
+			t = read_tsc() - start;
+			cprintf("  %8u", (uint32_t) (t / iters));
+		}
+		string_init(orig);
+		cprintf("\n");
+	}
+}
+
+/*
+ * Symbol lookup.  Checks that debuginfo_eip's index places some known
+ * functions, and that random kernel text addresses resolve to a
+ * function that starts at or before them.  Then times the lookup.
+ */
+
+#define SYM_LOOKUPS	1000
+
+static void bench_debuginfo(void);
+
+// Functions any kernel's symbol table must place correctly.
+static const struct {
+	uintptr_t addr;
+	const char *name;
+	const char *file;
+} sym_known[] = {
+	{ (uintptr_t) mon_backtrace, "mon_backtrace", "kern/monitor.c" },
+	{ (uintptr_t) cprintf, "cprintf", "kern/printf.c" },
+	{ (uintptr_t) debuginfo_eip, "debuginfo_eip", "kern/kdebug.c" },
+	{ (uintptr_t) bench_debuginfo, "bench_debuginfo", "kern/bench.c" },
+};
+
+// Time 'lookup' over random kernel text addresses, in cycles per call.
+static uint32_t
+sym_time(int (*lookup)(uintptr_t, struct Eipdebuginfo *))
+{
+	extern char entry[], etext[];
+	struct Eipdebuginfo info;
+	uintptr_t addrs[NVALUES];
+	uint64_t start;
+	int i;
+
+	for (i = 0; i < NVALUES; i++)
+		addrs[i] = (uintptr_t) entry + bench_rand() % (etext - entry);
+	start = read_tsc();
+	for (i = 0; i < NVALUES * 16; i++)
+		bench_sink += lookup(addrs[i % NVALUES], &info);
+	return (read_tsc() - start) / (NVALUES * 16);
+}
+
+static void
+bench_debuginfo(void)
+{
+	extern char entry[], etext[];
+	struct Eipdebuginfo idx;
+	int i, ri, checked = 0, bad = 0;
+
+	if (kdebug_init() < 0) {
+		cprintf("no address index\n");
+		return;
+	}
+
+	// The index must at least find these.
+	for (i = 0; i < ARRAY_SIZE(sym_known); i++) {
+		ri = debuginfo_eip(sym_known[i].addr, &idx);
+		if (ri < 0 || idx.eip_fn_addr != sym_known[i].addr || idx.eip_line <= 0
+		    || idx.eip_fn_namelen != strlen(sym_known[i].name)
+		    || memcmp(idx.eip_fn_name, sym_known[i].name, idx.eip_fn_namelen) != 0
+		    || strcmp(idx.eip_file, sym_known[i].file) != 0) {
+			bad++;
+			cprintf("%08x: index %s:%d %.*s, expected %s in %s\n",
+				sym_known[i].addr, idx.eip_file, idx.eip_line,
+				idx.eip_fn_namelen, idx.eip_fn_name,
+				sym_known[i].name, sym_known[i].file);
+		}
+	}
+	cprintf("%d of %d known functions misplaced\n", bad, ARRAY_SIZE(sym_known));
+
+	// Anything the index resolves must lie in the function it names.
+	bad = 0;
+	for (i = 0; i < SYM_LOOKUPS; i++) {
+		uintptr_t a = (uintptr_t) entry + bench_rand() % (etext - entry);
+		if (debuginfo_eip(a, &idx) < 0)
+			continue;
+		checked++;
+		if (idx.eip_fn_addr > a && bad++ < 4)
+			cprintf("%08x: index %s:%d %.*s starts at %08x\n", a,
+				idx.eip_file, idx.eip_line, idx.eip_fn_namelen,
+				idx.eip_fn_name, idx.eip_fn_addr);
+	}
+	cprintf("%d of %d resolved lookups outside their function\n", bad, checked);
+
+	cprintf("cycles per lookup: %u\n", sym_time(debuginfo_eip));
+}
+
+static struct Bench benches[] = {
+	{ "printnum", "Integer conversions in printfmt", bench_printnum },
+	{ "printfmt", "Format parsing vs. compiled formats", bench_printfmt },
+	{ "memcpy", "memcpy from 16 bytes to 1MB", bench_memcpy },
+	{ "page", "Page copy/clear, cached vs. non-temporal", bench_page },
+	{ "scan", "Check and time strlen/strchr/memcmp/memfind", bench_scan },
+	{ "debuginfo", "Check and time the symbol index", bench_debuginfo },
+};
+
+static void
+bench_list(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++)
+		cprintf("%-10s %s\n", benches[i].name, benches[i].desc);
+}
+
+static int
+bench_run(const char *name)
+{
+	int i, found = 0;
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++)
+		if (strcmp(name, "all") == 0 || strcmp(name, benches[i].name) == 0) {
+			if (found++)
+				cprintf("\n");
+			cprintf("%s:\n", benches[i].name);
+			benches[i].func();
+		}
+	return found ? 0 : -E_INVAL;
+}
+
+static int
+mon_bench(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 1) {
+		bench_list();
+		return 0;
+	}
+	if (bench_run(argv[1]) < 0)
+		cprintf("No benchmark '%s'\n", argv[1]);
+	return 0;
+}
+
+MONITOR_COMMAND("bench", "List micro-benchmarks, or run one [name|all]", mon_bench);
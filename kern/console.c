@@ -5,11 +5,16 @@
 #include <inc/kbdreg.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/error.h>
 
 #include <kern/console.h>
+#include <kern/softirq.h>
+#include <kern/apic.h>
+#include <kern/klog.h>
+#include <kern/profile.h>
 
-static void cons_intr(int (*proc)(void));
 static void cons_putc(int c);
+static void cons_putbuf(int c);
 
 // Stupid I/O delay routine necessitated by historical PC design flaws
 static void
@@ -21,6 +26,45 @@ delay(void)
 	inb(0x84);
 }
 
+/***** Raw input queues *****/
+// Interrupt top halves only move bytes from the device into one of these
+// queues; the bottom half interprets them and feeds the console buffer.
+// Each queue has a single producer and a single consumer.
+
+#define RAWQSIZE	128	// must be a power of 2
+
+struct rawq {
+	uint8_t buf[RAWQSIZE];
+	volatile uint32_t rpos;
+	volatile uint32_t wpos;
+};
+
+static void
+rawq_put(struct rawq *q, int irq, uint8_t c)
+{
+	if (q->wpos - q->rpos == RAWQSIZE) {
+		irqstat[irq].is_drops++;
+		klog("rawq: irq %d dropped 0x%02x\n", irq, c);
+		return;
+	}
+	q->buf[q->wpos % RAWQSIZE] = c;
+	q->wpos++;
+	irqstat[irq].is_items++;
+}
+
+static int
+rawq_get(struct rawq *q)
+{
+	int c;
+
+	if (q->rpos == q->wpos)
+		return -1;
+	c = q->buf[q->rpos % RAWQSIZE];
+	q->rpos++;
+	return c;
+}
+
+
 /***** Serial I/O code *****/
 
 #define COM1		0x3F8
@@ -31,8 +75,14 @@ delay(void)
 #define COM_DLM		1	// Out: Divisor Latch High (DLAB=1)
 #define COM_IER		1	// Out: Interrupt Enable Register
 #define   COM_IER_RDI	0x01	//   Enable receiver data interrupt
+#define   COM_IER_THREI	0x02	//   Enable transmitter empty interrupt
 #define COM_IIR		2	// In:	Interrupt ID Register
+#define   COM_IIR_FIFO	0xC0	//   FIFOs enabled (16550A)
 #define COM_FCR		2	// Out: FIFO Control Register
+#define   COM_FCR_ENABLE	0x01	//   Enable FIFOs
+#define   COM_FCR_RCVR_RESET	0x02	//   Clear receive FIFO
+#define   COM_FCR_XMIT_RESET	0x04	//   Clear transmit FIFO
+#define   COM_FCR_TRIGGER_8	0x80	//   Receive interrupt at 8 bytes
 #define COM_LCR		3	// Out: Line Control Register
 #define	  COM_LCR_DLAB	0x80	//   Divisor latch access bit
 #define	  COM_LCR_WLEN8	0x03	//   Wordlength: 8 bits
@@ -45,45 +95,174 @@ delay(void)
 #define   COM_LSR_TXRDY	0x20	//   Transmit buffer avail
 #define   COM_LSR_TSRE	0x40	//   Transmitter off
 
+#define COM_BAUD	115200
+#define COM_FIFO_SIZE	16	// 16550A transmit FIFO depth
+
 static bool serial_exists;
+static struct rawq serial_rawq;
 
-static int
-serial_proc_data(void)
+// Transmit ring.  serial_putc() appends here; serial_tx_fill() moves
+// bytes into the UART FIFO whenever it has room.
+#define SERIAL_TXBUFSIZE	1024	// must be a power of 2
+
+static struct {
+	uint8_t buf[SERIAL_TXBUFSIZE];
+	volatile uint32_t rpos;
+	volatile uint32_t wpos;
+} serial_tx;
+
+static int serial_fifo_size = 1;
+// Bytes we may still write before the FIFO could be full.  LSR only
+// says when the FIFO is completely empty, so count writes since then.
+static int serial_tx_credit;
+// Set once something calls serial_intr() regularly to refill the FIFO;
+// until then every serial_putc() pushes its own data out.
+static bool serial_tx_irq;
+static uint8_t serial_ier = COM_IER_RDI;
+static uint32_t serial_tx_drops;	// Bytes lost to a wedged UART
+
+static void serial_tx_fill(void);
+
+static void
+serial_set_ier(uint8_t ier)
 {
-	if (!(inb(COM1+COM_LSR) & COM_LSR_DATA))
-		return -1;
-	return inb(COM1+COM_RX);
+	if (ier != serial_ier)
+		outb(COM1+COM_IER, ier);
+	serial_ier = ier;
 }
 
+// Top half: refill the transmit FIFO and drain the receive buffer
+// into the raw queue.
 void
 serial_intr(void)
 {
-	if (serial_exists)
-		cons_intr(serial_proc_data);
+	bool any = 0;
+
+	if (!serial_exists)
+		return;
+	// Reading IIR acknowledges a THRE interrupt.  With nothing left
+	// to send, stop asking for more, or THRE stays pending and holds
+	// the edge-triggered line high through later receive interrupts.
+	(void) inb(COM1+COM_IIR);
+	serial_tx_fill();
+	if (serial_tx.rpos == serial_tx.wpos)
+		serial_set_ier(COM_IER_RDI);
+	while (inb(COM1+COM_LSR) & COM_LSR_DATA) {
+		rawq_put(&serial_rawq, IRQ_SERIAL, inb(COM1+COM_RX));
+		any = 1;
+	}
+	if (any) {
+		irqstat[IRQ_SERIAL].is_count++;
+		softirq_raise(SOFTIRQ_SERIAL);
+	}
 }
 
+// Bottom half
 static void
-serial_putc(int c)
+serial_bh(void)
+{
+	int c;
+
+	while ((c = rawq_get(&serial_rawq)) != -1)
+		cons_putbuf(c);
+}
+
+// Write as much of the transmit ring as the FIFO will take
+// without waiting.
+static void
+serial_tx_fill(void)
+{
+	while (serial_tx.rpos != serial_tx.wpos) {
+		if (serial_tx_credit == 0) {
+			if (!(inb(COM1+COM_LSR) & COM_LSR_TXRDY))
+				return;
+			serial_tx_credit = serial_fifo_size;
+		}
+		outb(COM1+COM_TX,
+		     serial_tx.buf[serial_tx.rpos % SERIAL_TXBUFSIZE]);
+		serial_tx.rpos++;
+		serial_tx_credit--;
+	}
+}
+
+// Wait (boundedly) until the transmit ring has drained into the FIFO.
+static void
+serial_tx_drain(void)
 {
 	int i;
 
-	for (i = 0;
-	     !(inb(COM1 + COM_LSR) & COM_LSR_TXRDY) && i < 12800;
-	     i++)
+	for (i = 0; i < 12800; i++) {
+		serial_tx_fill();
+		if (serial_tx.rpos == serial_tx.wpos)
+			return;
 		delay();
+	}
+}
 
-	outb(COM1 + COM_TX, c);
+static void
+serial_putc(int c)
+{
+	uint32_t eflags;
+
+	if (!serial_exists)
+		return;
+
+	// serial_intr() also consumes the ring.
+	eflags = read_eflags();
+	asm volatile("cli");
+
+	// Wait for room if the ring is full; only a wedged UART
+	// loses output, and that is counted.
+	if (serial_tx.wpos - serial_tx.rpos == SERIAL_TXBUFSIZE)
+		serial_tx_drain();
+	if (serial_tx.wpos - serial_tx.rpos == SERIAL_TXBUFSIZE)
+		serial_tx_drops++;
+	else {
+		serial_tx.buf[serial_tx.wpos % SERIAL_TXBUFSIZE] = c;
+		serial_tx.wpos++;
+	}
+
+	serial_tx_fill();
+	if (!serial_tx_irq)
+		serial_tx_drain();
+	else if (serial_tx.rpos != serial_tx.wpos)
+		serial_set_ier(COM_IER_RDI | COM_IER_THREI);
+
+	write_eflags(eflags);
+}
+
+// From now on the ring is refilled by serial_intr(), from THRE
+// interrupts or from cons_poll(), and serial_putc() no longer waits
+// for the UART.  Only for whoever installs the IRQ_SERIAL handler: with
+// nothing but cons_poll() to drain it, the ring would sit unsent for as
+// long as the kernel computes without waiting for input.
+void
+serial_tx_intr_enable(void)
+{
+	if (serial_exists)
+		serial_tx_irq = 1;
+}
+
+// Go back to pushing all output out at once, for when nothing may ever
+// call serial_intr() again.
+static void
+serial_tx_sync(void)
+{
+	serial_tx_irq = 0;
+	serial_tx_drain();
+	serial_set_ier(COM_IER_RDI);
 }
 
 static void
 serial_init(void)
 {
-	// Turn off the FIFO
-	outb(COM1+COM_FCR, 0);
+	// Turn on and clear the FIFOs
+	outb(COM1+COM_FCR, COM_FCR_ENABLE | COM_FCR_RCVR_RESET |
+	     COM_FCR_XMIT_RESET | COM_FCR_TRIGGER_8);
 
 	// Set speed; requires DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_DLAB);
-	outb(COM1+COM_DLL, (uint8_t) (115200 / 9600));
+	outb(COM1+COM_DLL, (uint8_t) (115200 / COM_BAUD));
 	outb(COM1+COM_DLM, 0);
 
 	// 8 data bits, 1 stop bit, parity off; turn off DLAB latch
@@ -97,9 +276,15 @@ serial_init(void)
 	// Clear any preexisting overrun indications and interrupts
 	// Serial port doesn't exist if COM_LSR returns 0xFF
 	serial_exists = (inb(COM1+COM_LSR) != 0xFF);
-	(void) inb(COM1+COM_IIR);
+	// Only a 16550A reports working FIFOs; older UARTs hold one byte.
+	if ((inb(COM1+COM_IIR) & COM_IIR_FIFO) == COM_IIR_FIFO)
+		serial_fifo_size = COM_FIFO_SIZE;
 	(void) inb(COM1+COM_RX);
 
+	softirq_register(SOFTIRQ_SERIAL, IRQ_SERIAL, serial_bh);
+	if (serial_exists)
+		ioapic_route(IRQ_SERIAL, 0);
+
 }
 
 
@@ -108,44 +293,123 @@ serial_init(void)
 // For information on PC parallel port programming, see the class References
 // page.
 
+#define LPT1		0x378
+
+static bool lpt_exists;
+
 static void
 lpt_putc(int c)
 {
 	int i;
 
-	for (i = 0; !(inb(0x378+1) & 0x80) && i < 12800; i++)
+	for (i = 0; !(inb(LPT1+1) & 0x80) && i < 12800; i++)
 		delay();
-	outb(0x378+0, c);
-	outb(0x378+2, 0x08|0x04|0x01);
-	outb(0x378+2, 0x08);
+	outb(LPT1+0, c);
+	outb(LPT1+2, 0x08|0x04|0x01);
+	outb(LPT1+2, 0x08);
+}
+
+static void
+lpt_init(void)
+{
+	// The data register reads back what was written to it;
+	// with no port there, reads float to 0xFF.
+	outb(LPT1+0, 0xAA);
+	lpt_exists = (inb(LPT1+0) == 0xAA);
+	outb(LPT1+0, 0);
 }
 
 
 
 
 /***** Text-mode CGA/VGA display output *****/
-
+// The adapter's text memory holds many more rows than the 25 on screen,
+// and the 6845 displays from a programmable start address.  So output
+// runs down video memory, scrolling just moves the start address, and
+// the rows above the screen remain available as scrollback (PgUp/PgDn).
+// Only when output reaches the end of video memory are the newest rows
+// copied back to the beginning.
+//
+// Characters are drawn into a shadow copy of video memory in ordinary
+// RAM; cga_flush() copies the rows that changed out to the (slow,
+// uncached) video memory and updates the 6845 once per batch.
+
+#define CRT_VMEM_ROWS	((32 * 1024) / (CRT_COLS * sizeof(uint16_t)))
+
+static bool crt_exists;
 static unsigned addr_6845;
 static uint16_t *crt_buf;
-static uint16_t crt_pos;
+static uint16_t crt_pos;	// Cursor position on the live screen
+
+static uint16_t crt_shadow[CRT_VMEM_ROWS * CRT_COLS];
+static int crt_rows;		// Rows of video memory we can use
+static int crt_origin;		// Video memory row at the top of the screen
+static int crt_view;		// Row actually displayed (< crt_origin in scrollback)
+static uint32_t crt_dirty[(CRT_VMEM_ROWS + 31) / 32];
+static bool crt_dirty_any;
+static bool crt_cursor_moved;
+
+static void
+crt_mark(int row)
+{
+	crt_dirty[row / 32] |= 1 << (row % 32);
+	crt_dirty_any = 1;
+}
+
+// Shadow cell for live screen position 'pos'
+static uint16_t *
+crt_cell(int pos)
+{
+	int row = crt_origin + pos / CRT_COLS;
+
+	crt_mark(row);
+	return &crt_shadow[row * CRT_COLS + pos % CRT_COLS];
+}
+
+static void
+crt_set_start(int row)
+{
+	unsigned addr = row * CRT_COLS;
+
+	outb(addr_6845, 12);
+	outb(addr_6845 + 1, addr >> 8);
+	outb(addr_6845, 13);
+	outb(addr_6845 + 1, addr);
+}
+
+// Is there video memory at 'cp'?  With no adapter there, the write
+// does not stick and reads float to 0xFFFF.
+static bool
+crt_probe(volatile uint16_t *cp)
+{
+	uint16_t was = *cp;
+
+	*cp = (uint16_t) 0xA55A;
+	if (*cp != 0xA55A)
+		return 0;
+	*cp = was;
+	return 1;
+}
 
 static void
 cga_init(void)
 {
 	volatile uint16_t *cp;
-	uint16_t was;
 	unsigned pos;
 
 	cp = (uint16_t*) (KERNBASE + CGA_BUF);
-	was = *cp;
-	*cp = (uint16_t) 0xA55A;
-	if (*cp != 0xA55A) {
+	if (crt_probe(cp)) {
+		addr_6845 = CGA_BASE;
+		crt_rows = CRT_VMEM_ROWS;
+	} else {
 		cp = (uint16_t*) (KERNBASE + MONO_BUF);
+		if (!crt_probe(cp))
+			return;
 		addr_6845 = MONO_BASE;
-	} else {
-		*cp = was;
-		addr_6845 = CGA_BASE;
+		// An MDA has only 4KB: room for the screen and no more.
+		crt_rows = CRT_ROWS;
 	}
+	crt_exists = 1;
 
 	/* Extract cursor location */
 	outb(addr_6845, 14);
@@ -154,10 +418,40 @@ cga_init(void)
 	pos |= inb(addr_6845 + 1);
 
 	crt_buf = (uint16_t*) cp;
-	crt_pos = pos;
+	crt_pos = pos < CRT_SIZE ? pos : 0;
+
+	// Start from whatever the BIOS left on the screen,
+	// displayed from the start of video memory.
+	memmove(crt_shadow, crt_buf, CRT_SIZE * sizeof(uint16_t));
+	crt_origin = crt_view = 0;
+	crt_set_start(0);
 }
 
+// Advance the live screen by one row.
+static void
+cga_scroll(void)
+{
+	uint16_t *row;
+	int keep, i;
+
+	if (crt_origin + CRT_ROWS == crt_rows) {
+		// Out of video memory: move the newest rows (at least the
+		// screen, at most half of memory) back to the start.
+		keep = MAX(crt_rows / 2, CRT_ROWS - 1);
+		memmove(crt_shadow, crt_shadow + (crt_rows - keep) * CRT_COLS,
+			keep * CRT_COLS * sizeof(uint16_t));
+		for (i = 0; i < keep; i++)
+			crt_mark(i);
+		crt_origin = keep - CRT_ROWS;
+	}
 
+	crt_origin++;
+	row = &crt_shadow[(crt_origin + CRT_ROWS - 1) * CRT_COLS];
+	for (i = 0; i < CRT_COLS; i++)
+		row[i] = 0x0700 | ' ';
+	crt_mark(crt_origin + CRT_ROWS - 1);
+	crt_pos -= CRT_COLS;
+}
 
 static void
 cga_putc(int c)
@@ -170,7 +464,7 @@ cga_putc(int c)
 	case '\b':
 		if (crt_pos > 0) {
 			crt_pos--;
-			crt_buf[crt_pos] = (c & ~0xff) | ' ';
+			*crt_cell(crt_pos) = (c & ~0xff) | ' ';
 		}
 		break;
 	case '\n':
@@ -180,32 +474,69 @@ cga_putc(int c)
 		crt_pos -= (crt_pos % CRT_COLS);
 		break;
 	case '\t':
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
 		break;
 	default:
-		crt_buf[crt_pos++] = c;		/* write the character */
+		*crt_cell(crt_pos++) = c;	/* write the character */
 		break;
 	}
 
-	// What is the purpose of this?
-	if (crt_pos >= CRT_SIZE) {
-		int i;
+	if (crt_pos >= CRT_SIZE)
+		cga_scroll();
+
+	crt_cursor_moved = 1;
+}
+
+// Copy changed rows to video memory and update the start address and
+// cursor.  Called once per batch of output.
+static void
+cga_flush(void)
+{
+	int i, row;
+
+	if (crt_dirty_any) {
+		for (i = 0; i < ARRAY_SIZE(crt_dirty); i++)
+			for (; crt_dirty[i]; crt_dirty[i] &= crt_dirty[i] - 1) {
+				row = i * 32 + __builtin_ctz(crt_dirty[i]);
+				memcpy(crt_buf + row * CRT_COLS,
+				       crt_shadow + row * CRT_COLS,
+				       CRT_COLS * sizeof(uint16_t));
+			}
+		crt_dirty_any = 0;
+
+		// New output ends any scrollback.
+		if (crt_view != crt_origin) {
+			crt_view = crt_origin;
+			crt_set_start(crt_view);
+		}
+	}
+
+	if (crt_cursor_moved) {
+		/* move that little blinky thing */
+		unsigned pos = crt_origin * CRT_COLS + crt_pos;
 
-		memmove(crt_buf, crt_buf + CRT_COLS, (CRT_SIZE - CRT_COLS) * sizeof(uint16_t));
-		for (i = CRT_SIZE - CRT_COLS; i < CRT_SIZE; i++)
-			crt_buf[i] = 0x0700 | ' ';
-		crt_pos -= CRT_COLS;
+		outb(addr_6845, 14);
+		outb(addr_6845 + 1, pos >> 8);
+		outb(addr_6845, 15);
+		outb(addr_6845 + 1, pos);
+		crt_cursor_moved = 0;
 	}
+}
 
-	/* move that little blinky thing */
-	outb(addr_6845, 14);
-	outb(addr_6845 + 1, crt_pos >> 8);
-	outb(addr_6845, 15);
-	outb(addr_6845 + 1, crt_pos);
+// Scroll the display back by 'rows' (forward if negative), within the
+// history retained in video memory.
+static void
+cga_scrollback(int rows)
+{
+	if (!crt_exists)
+		return;
+	cons_flush();
+	crt_view = MAX(0, MIN(crt_view - rows, crt_origin));
+	crt_set_start(crt_view);
 }
 
 
@@ -308,26 +639,18 @@ static uint8_t *charcode[4] = {
 	ctlmap
 };
 
+static struct rawq kbd_rawq;
+
 /*
- * Get data from the keyboard.  If we finish a character, return it.  Else 0.
- * Return -1 if no data.
+ * Interpret one scancode from the keyboard.
+ * If we finish a character, return it.  Else 0.
  */
 static int
-kbd_proc_data(void)
+kbd_decode(uint8_t data)
 {
 	int c;
-	uint8_t stat, data;
 	static uint32_t shift;
 
-	stat = inb(KBSTATP);
-	if ((stat & KBS_DIB) == 0)
-		return -1;
-	// Ignore data from mouse.
-	if (stat & KBS_TERR)
-		return -1;
-
-	data = inb(KBDATAP);
-
 	if (data == 0xE0) {
 		// E0 escape character
 		shift |= E0ESC;
@@ -358,21 +681,57 @@ kbd_proc_data(void)
 	// Ctrl-Alt-Del: reboot
 	if (!(~shift & (CTL | ALT)) && c == KEY_DEL) {
 		cprintf("Rebooting!\n");
+		cons_flush();
 		outb(0x92, 0x3); // courtesy of Chris Frost
 	}
 
 	return c;
 }
 
+// Top half: collect raw scancodes; decoding waits for the bottom half.
 void
 kbd_intr(void)
 {
-	cons_intr(kbd_proc_data);
+	uint8_t stat;
+	bool any = 0;
+
+	while ((stat = inb(KBSTATP)) & KBS_DIB) {
+		// Ignore data from mouse.
+		if (stat & KBS_TERR)
+			break;
+		rawq_put(&kbd_rawq, IRQ_KBD, inb(KBDATAP));
+		any = 1;
+	}
+	if (any) {
+		irqstat[IRQ_KBD].is_count++;
+		softirq_raise(SOFTIRQ_KBD);
+	}
+}
+
+// Bottom half
+static void
+kbd_bh(void)
+{
+	int c;
+
+	while ((c = rawq_get(&kbd_rawq)) != -1) {
+		c = kbd_decode(c);
+		// PgUp/PgDn page through the display's scrollback.
+		if (c == KEY_PGUP)
+			cga_scrollback(CRT_ROWS / 2);
+		else if (c == KEY_PGDN)
+			cga_scrollback(-CRT_ROWS / 2);
+		else if (c != 0)
+			cons_putbuf(c);
+	}
 }
 
 static void
 kbd_init(void)
 {
+	softirq_register(SOFTIRQ_KBD, IRQ_KBD, kbd_bh);
+	// Deliver keyboard interrupts to the boot CPU (APIC ID 0)
+	ioapic_route(IRQ_KBD, 0);
 }
 
 
@@ -381,69 +740,375 @@ kbd_init(void)
 // Here we manage the console input buffer,
 // where we stash characters received from the keyboard or serial port
 // whenever the corresponding interrupt occurs.
+//
+// In canonical mode (CONS_ICANON) the buffer also acts as a line
+// discipline: the line being typed sits between lpos and wpos, where
+// erase and kill can still edit it, and becomes readable once it is
+// ended by a newline.  In raw mode every character is readable at once.
 
-#define CONSBUFSIZE 512
+#define CONSBUFSIZE 4096	// must be a power of 2
 
 static struct {
 	uint8_t buf[CONSBUFSIZE];
-	uint32_t rpos;
-	uint32_t wpos;
+	uint32_t rpos;		// Next character to read
+	uint32_t lpos;		// End of readable input
+	uint32_t wpos;		// End of input, including the line being edited
+	uint32_t overruns;	// Characters dropped because the buffer was full
 } cons;
 
-// called by device interrupt routines to feed input characters
+static int cons_mode;
+
+static void
+cons_echo(int c)
+{
+	if (cons_mode & CONS_ECHO)
+		cputchar(c);
+}
+
+static void
+cons_erase(void)
+{
+	cons.wpos--;
+	if (cons_mode & CONS_ECHO) {
+		cputchar('\b');
+		cputchar(' ');
+		cputchar('\b');
+	}
+}
+
+// called by device bottom halves to feed input characters
 // into the circular console input buffer.
 static void
-cons_intr(int (*proc)(void))
+cons_putbuf(int c)
 {
-	int c;
+	if (cons_mode & CONS_ICANON) {
+		if (c == '\r')
+			c = '\n';
+		if (c == '\b' || c == '\x7f') {
+			if (cons.wpos != cons.lpos)
+				cons_erase();
+			return;
+		}
+		if (c == C('U')) {
+			while (cons.wpos != cons.lpos)
+				cons_erase();
+			return;
+		}
+	}
 
-	while ((c = (*proc)()) != -1) {
-		if (c == 0)
-			continue;
-		cons.buf[cons.wpos++] = c;
-		if (cons.wpos == CONSBUFSIZE)
-			cons.wpos = 0;
+	if (cons.wpos - cons.rpos == CONSBUFSIZE) {
+		cons.overruns++;
+		klog("cons: input buffer full, dropped 0x%02x\n", c);
+		// A line that fills the whole buffer can never be ended;
+		// hand it to the reader as it is.
+		cons.lpos = cons.wpos;
+		return;
 	}
+	cons.buf[cons.wpos++ % CONSBUFSIZE] = c;
+	cons_echo(c);
+
+	if (!(cons_mode & CONS_ICANON) || c == '\n')
+		cons.lpos = cons.wpos;
 }
 
-// return the next input character from the console, or 0 if none waiting
-int
-cons_getc(void)
+// Select raw or canonical input and whether to echo.
+void
+cons_setmode(int mode)
 {
-	int c;
+	// Anything typed so far becomes readable as it is.
+	cons.lpos = cons.wpos;
+	cons_mode = mode;
+}
 
+// poll the input devices, and run their bottom halves
+static void
+cons_poll(void)
+{
 	// poll for any pending input characters,
 	// so that this function works even when interrupts are disabled
 	// (e.g., when called from the kernel monitor).
 	serial_intr();
 	kbd_intr();
+	softirq_run();
+	// Likewise stand in for the timer interrupt's profiling tick.
+	profile_poll();
+
+	// Whoever waits for input has time to push out pending output.
+	cons_flush();
+}
+
+// return the next input character from the console, or 0 if none waiting
+int
+cons_getc(void)
+{
+	cons_poll();
 
 	// grab the next character from the input buffer.
-	if (cons.rpos != cons.wpos) {
-		c = cons.buf[cons.rpos++];
-		if (cons.rpos == CONSBUFSIZE)
-			cons.rpos = 0;
-		return c;
-	}
+	if (cons.rpos != cons.lpos)
+		return cons.buf[cons.rpos++ % CONSBUFSIZE];
 	return 0;
 }
 
+// Read up to 'n' bytes of input into 'buf', waiting until there is some.
+// In canonical mode this returns at most one line, newline included.
+int
+cons_read(char *buf, size_t n)
+{
+	size_t i;
+
+	if (n == 0)
+		return 0;
+	// With interrupts and environments, the caller would sleep here
+	// until a bottom half delivers input; for now, poll.
+	while (cons.rpos == cons.lpos)
+		cons_poll();
+
+	for (i = 0; i < n && cons.rpos != cons.lpos; ) {
+		buf[i] = cons.buf[cons.rpos++ % CONSBUFSIZE];
+		if (buf[i++] == '\n' && (cons_mode & CONS_ICANON))
+			break;
+	}
+	return i;
+}
+
+/***** Asynchronous console output *****/
+// Once the monitor starts, cputchar() and cprintf() only append to this
+// buffer; cons_flush() later writes it to each device.  The buffer is
+// flushed whenever the console waits for input, when it fills up, and
+// by the monitor before it prompts.  Until then, and for good once
+// cons_sync() is called (on panic), output goes straight to the
+// devices, so nothing printed during boot is lost to a hang or a triple
+// fault.
+
+#define CONSOUTSIZE 4096	// must be a power of 2
+
+static struct {
+	uint8_t buf[CONSOUTSIZE];
+	volatile uint32_t rpos;
+	volatile uint32_t wpos;
+} consout;
+
+static enum {
+	CONSOUT_DIRECT,		// Booting: write straight to the devices
+	CONSOUT_BUFFERED,	// Monitor running: write to consout
+	CONSOUT_SYNC		// After cons_sync(): direct for good
+} consout_mode;
+static bool consout_flushing;	// cons_flush() is writing consout out
+
+// Output devices.  cons_init() marks the ones it finds; the monitor's
+// 'console' command can switch present ones on and off.
+enum { SINK_SERIAL, SINK_LPT, SINK_CGA };
+
+static struct {
+	const char *name;
+	void (*putc)(int c);
+	void (*flush)(void);	// End of a batch of putc calls, or NULL
+	bool present;
+	bool enabled;
+} sinks[] = {
+	[SINK_SERIAL] = { "serial", serial_putc, NULL },
+	[SINK_LPT] = { "lpt", lpt_putc, NULL },
+	[SINK_CGA] = { "cga", cga_putc, cga_flush },
+};
+
+// The enabled, present sinks, so output touches nothing else.
+static void (*active_sinks[ARRAY_SIZE(sinks)])(int c);
+static int nactive_sinks;
+
+static void
+cons_sinks_update(void)
+{
+	int i;
+
+	nactive_sinks = 0;
+	for (i = 0; i < ARRAY_SIZE(sinks); i++)
+		if (sinks[i].present && sinks[i].enabled)
+			active_sinks[nactive_sinks++] = sinks[i].putc;
+}
+
+static void
+cons_putc_devices(int c)
+{
+	int i;
+
+	for (i = 0; i < nactive_sinks; i++)
+		active_sinks[i](c);
+}
+
+static void
+cons_flush_devices(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sinks); i++)
+		if (sinks[i].present && sinks[i].enabled && sinks[i].flush)
+			sinks[i].flush();
+}
+
+// Enable or disable the output device called 'name'.  Returns 0, or
+// -E_INVAL if there is no such device or it is the last one enabled,
+// since nothing could be seen, including the monitor, without one.
+int
+cons_sink_enable(const char *name, bool enable)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sinks); i++)
+		if (strcmp(sinks[i].name, name) == 0) {
+			if (!sinks[i].present)
+				return -E_INVAL;
+			if (!enable && sinks[i].enabled && nactive_sinks == 1)
+				return -E_INVAL;
+			// Drain what was written under the old
+			// selection before switching.
+			cons_flush();
+			sinks[i].enabled = enable;
+			cons_sinks_update();
+			return 0;
+		}
+	return -E_INVAL;
+}
+
+void
+cons_sink_print(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sinks); i++)
+		cprintf("%-8s %s\n", sinks[i].name,
+			!sinks[i].present ? "absent" :
+			sinks[i].enabled ? "on" : "off");
+	cprintf("input: %u buffered, %u dropped\n",
+		cons.wpos - cons.rpos, cons.overruns);
+	if (serial_exists)
+		cprintf("serial output: %u queued, %u dropped\n",
+			serial_tx.wpos - serial_tx.rpos, serial_tx_drops);
+}
+
+// Write all buffered output to the console devices.
+void
+cons_flush(void)
+{
+	int c;
+
+	if (consout_flushing)
+		return;
+	consout_flushing = 1;
+	while (consout.rpos != consout.wpos) {
+		c = consout.buf[consout.rpos % CONSOUTSIZE];
+		consout.rpos++;
+		cons_putc_devices(c);
+	}
+	cons_flush_devices();
+	consout_flushing = 0;
+}
+
+// Start buffering console output.  Called by the monitor, which
+// flushes before every prompt; does nothing after cons_sync().
+void
+cons_async(void)
+{
+	if (consout_mode == CONSOUT_DIRECT)
+		consout_mode = CONSOUT_BUFFERED;
+}
+
+// Flush, then bypass the buffer from now on.  For _panic(), which must
+// get its message out even if nothing ever flushes again.
+void
+cons_sync(void)
+{
+	consout_mode = CONSOUT_SYNC;
+	cons_flush();
+	serial_tx_sync();
+}
+
+// Make room in consout for at least one byte.  Returns false if there
+// is none because the caller was reached from cons_flush() itself (a
+// device printing while being written to), which must then write
+// straight to the devices rather than wait for a flush that cannot
+// happen or overwrite bytes not yet written out.
+static bool
+consout_room(void)
+{
+	if (consout.wpos - consout.rpos == CONSOUTSIZE)
+		cons_flush();
+	return consout.wpos - consout.rpos < CONSOUTSIZE;
+}
+
+// output a run of characters to the console
+static void
+cons_write(const char *buf, size_t len)
+{
+	uint32_t eflags;
+	size_t n;
+
+	if (consout_mode != CONSOUT_BUFFERED) {
+		while (len-- > 0)
+			cons_putc_devices(*buf++);
+		cons_flush_devices();
+		return;
+	}
+
+	eflags = read_eflags();
+	asm volatile("cli");
+	while (len > 0) {
+		if (!consout_room()) {
+			// cons_flush() finishes with cons_flush_devices().
+			while (len-- > 0)
+				cons_putc_devices(*buf++);
+			break;
+		}
+		// Copy up to the end of the ring or of the free space.
+		n = MIN(len, CONSOUTSIZE - (consout.wpos - consout.rpos));
+		n = MIN(n, CONSOUTSIZE - consout.wpos % CONSOUTSIZE);
+		memcpy(consout.buf + consout.wpos % CONSOUTSIZE, buf, n);
+		consout.wpos += n;
+		buf += n;
+		len -= n;
+	}
+	write_eflags(eflags);
+}
+
 // output a character to the console
 static void
 cons_putc(int c)
 {
-	serial_putc(c);
-	lpt_putc(c);
-	cga_putc(c);
+	uint32_t eflags;
+
+	if (consout_mode != CONSOUT_BUFFERED) {
+		cons_putc_devices(c);
+		cons_flush_devices();
+		return;
+	}
+
+	// Interrupt handlers print too.
+	eflags = read_eflags();
+	asm volatile("cli");
+	if (consout_room()) {
+		consout.buf[consout.wpos % CONSOUTSIZE] = c;
+		consout.wpos++;
+	} else
+		cons_putc_devices(c);
+	write_eflags(eflags);
 }
 
 // initialize the console devices
 void
 cons_init(void)
 {
+	int i;
+
 	cga_init();
 	kbd_init();
 	serial_init();
+	lpt_init();
+
+	sinks[SINK_SERIAL].present = serial_exists;
+	sinks[SINK_LPT].present = lpt_exists;
+	sinks[SINK_CGA].present = crt_exists;
+	for (i = 0; i < ARRAY_SIZE(sinks); i++)
+		sinks[i].enabled = sinks[i].present;
+	cons_sinks_update();
 
 	if (!serial_exists)
 		cprintf("Serial port does not exist!\n");
@@ -458,6 +1123,12 @@ cputchar(int c)
 	cons_putc(c);
 }
 
+void
+cwrite(const char *buf, size_t len)
+{
+	cons_write(buf, len);
+}
+
 int
 getchar(void)
 {
@@ -17,10 +17,22 @@
 #define CRT_COLS	80
 #define CRT_SIZE	(CRT_ROWS * CRT_COLS)
 
+// Console input modes for cons_setmode()
+#define CONS_ICANON	0x1	// Line editing; reads return whole lines
+#define CONS_ECHO	0x2	// Echo input as it arrives
+
 void cons_init(void);
 int cons_getc(void);
+void cons_setmode(int mode);
+int cons_read(char *buf, size_t n);
+void cons_flush(void);
+void cons_async(void);
+void cons_sync(void);
+int cons_sink_enable(const char *name, bool enable);
+void cons_sink_print(void);
 
 void kbd_intr(void); // irq 1
 void serial_intr(void); // irq 4
+void serial_tx_intr_enable(void);
 
 #endif /* _CONSOLE_H_ */
@@ -2,6 +2,7 @@
 #include <inc/memlayout.h>
 
 pte_t entry_pgtable[NPTENTRIES];
+pte_t entry_mmiopgtable[NPTENTRIES];
 
 // The entry.S page directory maps the first 4MB of physical memory
 // starting at virtual address KERNBASE (that is, it maps virtual
@@ -24,7 +25,18 @@ pde_t entry_pgdir[NPDENTRIES] = {
 		= ((uintptr_t)entry_pgtable - KERNBASE) + PTE_P,
 	// Map VA's [KERNBASE, KERNBASE+4MB) to PA's [0, 4MB)
 	[KERNBASE>>PDXSHIFT]
-		= ((uintptr_t)entry_pgtable - KERNBASE) + PTE_P + PTE_W
+		= ((uintptr_t)entry_pgtable - KERNBASE) + PTE_P + PTE_W,
+	// Map the interrupt controllers into the MMIO window
+	[MMIOBASE>>PDXSHIFT]
+		= ((uintptr_t)entry_mmiopgtable - KERNBASE) + PTE_P + PTE_W
+};
+
+// The local APIC and the I/O APIC, one uncached page each at the bottom
+// of the MMIO window (see LAPIC_VA and IOAPIC_VA in kern/apic.h).
+__attribute__((__aligned__(PGSIZE)))
+pte_t entry_mmiopgtable[NPTENTRIES] = {
+	0xfee00000 | PTE_P | PTE_W | PTE_PCD | PTE_PWT,
+	0xfec00000 | PTE_P | PTE_W | PTE_PCD | PTE_PWT,
 };
 
 // Entry 0 of the page table maps to physical page 0, entry 1 to
@@ -0,0 +1,31 @@
+// x87 and SSE enablement.
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/stdio.h>
+
+#include <kern/fpu.h>
+
+#define CPUID_FEAT_FXSR	0x01000000	// cpuid(1) %edx: FXSAVE/FXRSTOR
+#define CPUID_FEAT_SSE2	0x04000000	// cpuid(1) %edx: SSE2
+
+// Turn on the FPU and SSE, so that the string routines may use XMM
+// registers.  Nothing saves FPU state across environment switches, so
+// XMM registers are scratch for whoever runs.
+// Returns whether SSE2 is usable.
+bool
+fpu_init(void)
+{
+	uint32_t edx;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (!(edx & CPUID_FEAT_FXSR) || !(edx & CPUID_FEAT_SSE2)) {
+		cprintf("fpu: no SSE2, string routines stay word-sized\n");
+		return false;
+	}
+
+	lcr0((rcr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+	lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+	asm volatile("fninit");
+	return true;
+}
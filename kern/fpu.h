@@ -0,0 +1,11 @@
+#ifndef JOS_KERN_FPU_H
+#define JOS_KERN_FPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+bool fpu_init(void);
+
+#endif	// !JOS_KERN_FPU_H
@@ -5,7 +5,14 @@
 #include <inc/assert.h>
 
 #include <kern/monitor.h>
+#include <kern/kdebug.h>
 #include <kern/console.h>
+#include <kern/kinfo.h>
+#include <kern/kclock.h>
+#include <kern/apic.h>
+#include <kern/klog.h>
+#include <kern/fpu.h>
+#include <kern/pmu.h>
 
 // Test the stack backtrace function (lab 1 only)
 void
@@ -33,6 +40,25 @@ i386_init(void)
 	// Can't call cprintf until after we do this!
 	cons_init();
 
+	// Index the kernel's symbols for backtraces and the profiler.
+	kdebug_init();
+
+	// Publish boot-time values in the user-visible kernel info page.
+	kinfo_init();
+
+	// Enable SSE, then let the string routines pick what suits this CPU.
+	string_init(fpu_init() ? ~0 : ~STRING_SSE2);
+
+	// Calibrate the TSC, which all kernel timekeeping is based on.
+	kclock_init();
+
+	// Route device interrupts through the APICs instead of the 8259A.
+	lapic_init();
+	ioapic_init();
+
+	// Start the performance counters, if the CPU has them.
+	pmu_init();
+
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
 	// Test the stack backtrace function (lab 1 only)
@@ -66,12 +92,18 @@ _panic(const char *file, int line, const char *fmt,...)
 	// Be extra sure that the machine is in as reasonable state
 	asm volatile("cli; cld");
 
+	// Print synchronously from here on; nothing may flush later.
+	cons_sync();
+
 	va_start(ap, fmt);
 	cprintf("kernel panic at %s:%d: ", file, line);
 	vcprintf(fmt, ap);
 	cprintf("\n");
 	va_end(ap);
 
+	// Show what led up to the panic.
+	klog_dump();
+
 dead:
 	/* break into the kernel monitor */
 	while (1)
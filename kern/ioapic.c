@@ -0,0 +1,128 @@
+// The I/O APIC routes each device IRQ to a chosen local APIC, so that
+// device interrupts can be spread across CPUs.  Once it is running the
+// 8259A PIC is masked entirely.
+// See the Intel 82093AA I/O APIC datasheet.
+
+#include <inc/x86.h>
+#include <inc/stdio.h>
+
+#include <kern/apic.h>
+
+#define IOAPIC_ID	0x00	// Register index: ID
+#define IOAPIC_VER	0x01	// Register index: version
+#define IOAPIC_TABLE	0x10	// Redirection table base
+
+// The redirection table starts at IOAPIC_TABLE and uses
+// two registers to configure each interrupt.
+// The first (low) register in a pair contains configuration bits.
+// The second (high) register contains a bitmask telling which
+// CPUs can serve that interrupt.
+#define INT_DISABLED	0x00010000	// Interrupt disabled
+#define INT_LEVEL	0x00008000	// Level-triggered (vs edge-)
+#define INT_ACTIVELOW	0x00002000	// Active low (vs high)
+#define INT_LOGICAL	0x00000800	// Destination is CPU id (vs APIC ID)
+
+// 8259A PIC ports, only used to silence it
+#define IO_PIC1		0x20
+#define IO_PIC2		0xA0
+
+// IO APIC MMIO structure: write reg, then read or write data.
+struct ioapic {
+	uint32_t reg;
+	uint32_t pad[3];
+	uint32_t data;
+};
+
+static volatile struct ioapic *ioapic = (volatile struct ioapic *) IOAPIC_VA;
+static int nirqs;			// 0 until ioapic_init() finds one
+
+// Requested routing, kept so that drivers initialized before
+// ioapic_init() (the console) can still ask for their IRQs.
+static uint32_t irq_routed;		// Bit i set if IRQ i is enabled
+static uint8_t irq_dest[MAX_IOAPIC_IRQS];	// Target APIC ID
+
+static uint32_t
+ioapic_read(int reg)
+{
+	ioapic->reg = reg;
+	return ioapic->data;
+}
+
+static void
+ioapic_write(int reg, uint32_t data)
+{
+	ioapic->reg = reg;
+	ioapic->data = data;
+}
+
+static void
+ioapic_program(int irq)
+{
+	if (irq_routed & (1 << irq)) {
+		ioapic_write(IOAPIC_TABLE + 2*irq + 1, irq_dest[irq] << 24);
+		ioapic_write(IOAPIC_TABLE + 2*irq, IRQ_OFFSET + irq);
+	} else {
+		// Edge-triggered, active high, disabled,
+		// and not routed to any CPUs.
+		ioapic_write(IOAPIC_TABLE + 2*irq,
+			     INT_DISABLED | (IRQ_OFFSET + irq));
+		ioapic_write(IOAPIC_TABLE + 2*irq + 1, 0);
+	}
+}
+
+void
+ioapic_init(void)
+{
+	uint32_t ver;
+	int i;
+
+	if (!lapic_present)
+		return;
+	ver = ioapic_read(IOAPIC_VER);
+	if (ver == 0xFFFFFFFF) {
+		cprintf("ioapic: not present, keeping the 8259A\n");
+		return;
+	}
+
+	// From now on device interrupts come through the I/O APIC;
+	// mask every 8259A input so nothing arrives twice.
+	outb(IO_PIC1+1, 0xFF);
+	outb(IO_PIC2+1, 0xFF);
+
+	nirqs = MIN((int) ((ver >> 16) & 0xFF) + 1, MAX_IOAPIC_IRQS);
+	for (i = 0; i < nirqs; i++)
+		ioapic_program(i);
+}
+
+// Deliver 'irq' to the local APIC with ID 'apicid'.
+// Returns 0 on success, < 0 if the IRQ cannot be routed.
+int
+ioapic_route(int irq, int apicid)
+{
+	if (irq < 0 || irq >= MAX_IOAPIC_IRQS)
+		return -1;
+	irq_routed |= 1 << irq;
+	irq_dest[irq] = apicid;
+	if (irq < nirqs)
+		ioapic_program(irq);
+	return 0;
+}
+
+void
+ioapic_mask(int irq)
+{
+	if (irq < 0 || irq >= MAX_IOAPIC_IRQS)
+		return;
+	irq_routed &= ~(1 << irq);
+	if (irq < nirqs)
+		ioapic_program(irq);
+}
+
+// The APIC ID 'irq' is routed to, or -1 if it is masked.
+int
+irq_affinity(int irq)
+{
+	if (irq < 0 || irq >= MAX_IOAPIC_IRQS || !(irq_routed & (1 << irq)))
+		return -1;
+	return irq_dest[irq];
+}
@@ -0,0 +1,90 @@
+/* See COPYRIGHT for copyright information. */
+
+// The kernel's notion of time: the TSC, calibrated once at boot against
+// PIT counter 2.  The calibration is published in the kernel info page
+// and used to convert the cycle counts in the log and the profiler.
+
+#include <inc/x86.h>
+#include <inc/stdio.h>
+
+#include <kern/kclock.h>
+#include <kern/kinfo.h>
+#include <kern/klog.h>
+
+#define CPUID_FEAT_TSC	0x00000010	// cpuid(1) %edx: TSC present
+
+#define CALIBRATE_MS	10		// length of one calibration run
+#define CALIBRATE_RUNS	3
+// Give up on a run after this many cycles: far longer than CALIBRATE_MS
+// at any real clock rate, yet well under a second on a slow one.
+#define CALIBRATE_MAXCYCLES	(1ULL << 28)
+
+static uint32_t tsc_khz;
+
+// Count TSC cycles across CALIBRATE_MS of PIT counter 2 in one-shot
+// mode.  Returns 0 if the counter never fires (no PIT).
+static uint64_t
+tsc_calibrate_once(void)
+{
+	uint32_t count = TIMER_FREQ / (1000 / CALIBRATE_MS);
+	uint64_t t0, t1;
+	uint8_t ppi;
+
+	// Raise the counter 2 gate with the speaker disconnected.
+	ppi = inb(IO_PPI);
+	outb(IO_PPI, (ppi & ~PPI_SPKR) | PPI_GATE2);
+
+	outb(TIMER_MODE, TIMER_SEL2 | TIMER_16BIT | TIMER_INTTC);
+	outb(TIMER_CNTR2, count & 0xff);
+	outb(TIMER_CNTR2, count >> 8);
+
+	t0 = read_tsc();
+	while (!(inb(IO_PPI) & PPI_OUT2))
+		if (read_tsc() - t0 > CALIBRATE_MAXCYCLES) {
+			outb(IO_PPI, ppi);
+			return 0;
+		}
+	t1 = read_tsc();
+
+	outb(IO_PPI, ppi);
+	return t1 - t0;
+}
+
+void
+kclock_init(void)
+{
+	uint32_t edx;
+	uint64_t cycles, best = 0;
+	int i;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (!(edx & CPUID_FEAT_TSC)) {
+		cprintf("kclock: no TSC, time is unavailable\n");
+		return;
+	}
+
+	// The shortest run is the one least disturbed by SMIs
+	// and emulator scheduling.
+	for (i = 0; i < CALIBRATE_RUNS; i++) {
+		// A counter that never fired once will not fire later.
+		if ((cycles = tsc_calibrate_once()) == 0)
+			break;
+		if (best == 0 || cycles < best)
+			best = cycles;
+	}
+	if (best == 0) {
+		cprintf("kclock: PIT did not respond, TSC uncalibrated\n");
+		return;
+	}
+
+	tsc_khz = (uint32_t) (best / CALIBRATE_MS);
+	kinfo_set_clock(0, tsc_khz);
+	klog("kclock: TSC %u kHz, best of %d runs %llu cycles\n",
+	     tsc_khz, CALIBRATE_RUNS, best);
+}
+
+uint32_t
+kclock_tsc_khz(void)
+{
+	return tsc_khz;
+}
@@ -0,0 +1,33 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KCLOCK_H
+#define JOS_KERN_KCLOCK_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Intel 8253/8254 programmable interval timer (PIT)
+#define	TIMER_FREQ	1193182		// input clock frequency (Hz)
+#define	IO_TIMER1	0x040		// 8253 timer #1
+#define	TIMER_CNTR0	(IO_TIMER1 + 0)	// timer 0 counter port
+#define	TIMER_CNTR2	(IO_TIMER1 + 2)	// timer 2 counter port
+#define	TIMER_MODE	(IO_TIMER1 + 3)	// timer mode port
+#define	  TIMER_SEL0	0x00		//   select counter 0
+#define	  TIMER_SEL2	0x80		//   select counter 2
+#define	  TIMER_INTTC	0x00		//   mode 0: interrupt on terminal count
+#define	  TIMER_RATEGEN	0x04		//   mode 2: rate generator
+#define	  TIMER_16BIT	0x30		//   r/w counter 16 bits, LSB first
+
+// System control port B: gates and reads back PIT counter 2
+#define	IO_PPI		0x061
+#define	  PPI_GATE2	0x01		//   counter 2 gate
+#define	  PPI_SPKR	0x02		//   speaker data enable
+#define	  PPI_OUT2	0x20		//   counter 2 output (read only)
+
+void kclock_init(void);
+
+uint32_t kclock_tsc_khz(void);
+
+#endif	// !JOS_KERN_KCLOCK_H
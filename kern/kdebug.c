@@ -2,13 +2,20 @@
 #include <inc/string.h>
 #include <inc/memlayout.h>
 #include <inc/assert.h>
+#include <inc/stdio.h>
+#include <inc/mmu.h>
+#include <inc/x86.h>
 
 #include <kern/kdebug.h>
 
-extern const struct Stab __STAB_BEGIN__[];	// Beginning of stabs table
-extern const struct Stab __STAB_END__[];	// End of stabs table
-extern const char __STABSTR_BEGIN__[];		// Beginning of string table
-extern const char __STABSTR_END__[];		// End of string table
+// A user program's linker script leaves this at USTABDATA
+// to locate its stabs.
+struct UserStabData {
+	const struct Stab *stabs;
+	const struct Stab *stab_end;
+	const char *stabstr;
+	const char *stabstr_end;
+};
 
 
 // stab_binsearch(stabs, region_left, region_right, type, addr)
@@ -94,16 +101,150 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
 }
 
 
-// debuginfo_eip(addr, info)
+/***** User stabs *****/
+
+// Is all of [va, va + len) mapped present and user-accessible in the
+// current address space?  Walks the page tables rather than touching
+// the memory, so bad user pointers cannot fault the kernel.
+static bool
+user_range_ok(uintptr_t va, size_t len)
+{
+	const pde_t *pgdir = (const pde_t *) (PTE_ADDR(rcr3()) + KERNBASE);
+	const pte_t *pgtab;
+	uintptr_t p, end = va + len;
+	pde_t pde;
+
+	if (end < va || end > ULIM)
+		return false;
+	for (p = ROUNDDOWN(va, PGSIZE); p < end; p += PGSIZE) {
+		pde = pgdir[PDX(p)];
+		if ((pde & (PTE_P | PTE_U)) != (PTE_P | PTE_U))
+			return false;
+		if (pde & PTE_PS)
+			continue;
+		// Page tables are reached through the KERNBASE mapping,
+		// and entry_pgdir maps only the first PTSIZE of it.
+		if (PTE_ADDR(pde) >= PTSIZE)
+			return false;
+		pgtab = (const pte_t *) (PTE_ADDR(pde) + KERNBASE);
+		if ((pgtab[PTX(p)] & (PTE_P | PTE_U)) != (PTE_P | PTE_U))
+			return false;
+	}
+	return true;
+}
+
+// Find the current user program's stabs through USTABDATA.
+// Returns 0, or -1 if any of them is not readable by the user.
+static int
+user_stabs(struct UserStabData *usd)
+{
+	if (!user_range_ok(USTABDATA, sizeof(*usd)))
+		return -1;
+	*usd = *(const struct UserStabData *) USTABDATA;
+	if (usd->stab_end < usd->stabs || usd->stabstr_end < usd->stabstr
+	    || !user_range_ok((uintptr_t) usd->stabs,
+			      (uintptr_t) usd->stab_end - (uintptr_t) usd->stabs)
+	    || !user_range_ok((uintptr_t) usd->stabstr,
+			      usd->stabstr_end - usd->stabstr))
+		return -1;
+	return 0;
+}
+
+static int debuginfo_user_stabs(uintptr_t addr, struct Eipdebuginfo *info);
+
+// Recent user lookups, per address space.  The file and function names
+// are copied out of the user's stabs when a lookup is made, so a cached
+// result never points into user memory; the Eipdebuginfo handed out
+// points into the cache instead and is only good until the next lookup.
+// Whatever reuses an address space for a new program should still call
+// kdebug_user_flush(), or stale results for its old contents persist.
+#define USYM_NSPACES	2	// Address spaces cached
+#define USYM_NLOOKUPS	64	// Lookups per address space, a power of 2
+#define USYM_NAMELEN	32	// Longest file or function name kept
+#define USYM_EMPTY	(~(uintptr_t) 0)
+
+struct UserSymCache {
+	physaddr_t us_cr3;		// Address space, or 0 if unused
+	uint32_t us_used;		// usym_clock when last used
+	struct {
+		uintptr_t addr;		// USYM_EMPTY if unused
+		int r;
+		struct Eipdebuginfo info;
+		char file[USYM_NAMELEN];
+		char fn_name[USYM_NAMELEN];
+	} us_lookups[USYM_NLOOKUPS];
+};
+
+static struct UserSymCache usym_cache[USYM_NSPACES];
+static uint32_t usym_clock;
+
+// Forget the cached lookups for address space 'cr3', or for all of
+// them if 'cr3' is 0.
+void
+kdebug_user_flush(physaddr_t cr3)
+{
+	int i;
+
+	for (i = 0; i < USYM_NSPACES; i++)
+		if (cr3 == 0 || usym_cache[i].us_cr3 == cr3)
+			usym_cache[i].us_cr3 = 0;
+}
+
+static int
+debuginfo_user(uintptr_t addr, struct Eipdebuginfo *info)
+{
+	struct UserSymCache *us, *victim = &usym_cache[0];
+	physaddr_t cr3 = PTE_ADDR(rcr3());
+	int i, slot;
+
+	for (us = usym_cache; us < usym_cache + USYM_NSPACES; us++) {
+		if (us->us_cr3 == cr3)
+			break;
+		if (us->us_used < victim->us_used || !us->us_cr3)
+			victim = us;
+	}
+	if (us == usym_cache + USYM_NSPACES) {
+		us = victim;
+		us->us_cr3 = cr3;
+		for (i = 0; i < USYM_NLOOKUPS; i++)
+			us->us_lookups[i].addr = USYM_EMPTY;
+	}
+	us->us_used = ++usym_clock;
+
+	slot = (addr * 2654435761U) >> 26;
+	if (us->us_lookups[slot].addr != addr) {
+		// The strings were range-checked by this very search,
+		// so they can be copied before anything can unmap them.
+		us->us_lookups[slot].r = debuginfo_user_stabs(addr, info);
+		strlcpy(us->us_lookups[slot].file, info->eip_file, USYM_NAMELEN);
+		info->eip_fn_namelen = MIN(info->eip_fn_namelen, USYM_NAMELEN);
+		memcpy(us->us_lookups[slot].fn_name, info->eip_fn_name,
+		       info->eip_fn_namelen);
+		info->eip_file = us->us_lookups[slot].file;
+		info->eip_fn_name = us->us_lookups[slot].fn_name;
+		us->us_lookups[slot].info = *info;
+		us->us_lookups[slot].addr = addr;
+	}
+	*info = us->us_lookups[slot].info;
+	return us->us_lookups[slot].r;
+}
+
+
+// debuginfo_user_stabs(addr, info)
 //
 //	Fill in the 'info' structure with information about the specified
-//	instruction address, 'addr'.  Returns 0 if information was found, and
-//	negative if not.  But even if it returns negative it has stored some
-//	information into '*info'.
+//	user instruction address, 'addr', by searching the current user
+//	program's stabs, found through USTABDATA.  Returns 0 if information
+//	was found, and negative if not.  But even if it returns negative it
+//	has stored some information into '*info'.
 //
-int
-debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
+//	The kernel itself carries no stabs; debuginfo_eip() answers for
+//	kernel addresses from the index below.
+//
+static int
+debuginfo_user_stabs(uintptr_t addr, struct Eipdebuginfo *info)
 {
+	struct UserStabData usd;
 	const struct Stab *stabs, *stab_end;
 	const char *stabstr, *stabstr_end;
 	int lfile, rfile, lfun, rfun, lline, rline;
@@ -117,15 +258,12 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 	info->eip_fn_narg = 0;
 
 	// Find the relevant set of stabs
-	if (addr >= ULIM) {
-		stabs = __STAB_BEGIN__;
-		stab_end = __STAB_END__;
-		stabstr = __STABSTR_BEGIN__;
-		stabstr_end = __STABSTR_END__;
-	} else {
-		// Can't search for user-level addresses yet!
-  	        panic("User address");
-	}
+	if (user_stabs(&usd) < 0)
+		return -1;
+	stabs = usd.stabs;
+	stab_end = usd.stab_end;
+	stabstr = usd.stabstr;
+	stabstr_end = usd.stabstr_end;
 
 	// String table validity checks
 	if (stabstr_end <= stabstr || stabstr_end[-1] != 0)
@@ -211,3 +349,111 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 
 	return 0;
 }
+
+
+/***** Address index *****/
+// debuginfo_eip() answers from the function and line tables described
+// in kern/kdebug.h, so a lookup is two plain binary searches, without
+// stab_binsearch's walks over stabs of other types.  The tables are
+// used in place from the .kdebug section that the build generates.
+
+extern const char __KDEBUG_BEGIN__[], __KDEBUG_END__[];
+
+static const struct KdebugFun *kd_funs;
+static const struct KdebugLine *kd_lines;
+static const char *kd_str;
+static uint32_t kd_nfuns, kd_nlines;
+static enum { KD_UNBUILT, KD_BUILT, KD_FAILED } kd_state;
+
+// Index of the last of 'n' entries of 'size' bytes, each starting with
+// its address and sorted by it, whose address is <= 'addr'; or -1.
+static int
+kd_search(const void *base, int n, size_t size, uintptr_t addr)
+{
+	int l = 0, r = n;
+
+	while (l < r) {
+		int m = (l + r) / 2;
+		if (*(const uintptr_t *) ((const char *) base + m * size) <= addr)
+			l = m + 1;
+		else
+			r = m;
+	}
+	return l - 1;
+}
+
+// Use the generated .kdebug section, if it is there and consistent.
+static int
+kd_load_section(void)
+{
+	const struct KdebugHeader *kh = (const struct KdebugHeader *) __KDEBUG_BEGIN__;
+	size_t size = __KDEBUG_END__ - __KDEBUG_BEGIN__;
+
+	if (size < sizeof(*kh) || kh->kh_magic != KDEBUG_MAGIC
+	    || size < sizeof(*kh) + kh->kh_nfuns * sizeof(struct KdebugFun)
+		      + kh->kh_nlines * sizeof(struct KdebugLine) + kh->kh_strsize)
+		return -1;
+	kd_funs = (const struct KdebugFun *) (kh + 1);
+	kd_lines = (const struct KdebugLine *) (kd_funs + kh->kh_nfuns);
+	kd_str = (const char *) (kd_lines + kh->kh_nlines);
+	kd_nfuns = kh->kh_nfuns;
+	kd_nlines = kh->kh_nlines;
+	return 0;
+}
+
+// Set up the index.  Returns 0, or -1 if the kernel was linked without
+// one, in which case debuginfo_eip() knows no kernel addresses.
+int
+kdebug_init(void)
+{
+	if (kd_state == KD_UNBUILT)
+		kd_state = kd_load_section() == 0 ? KD_BUILT : KD_FAILED;
+	return kd_state == KD_BUILT ? 0 : -1;
+}
+
+// debuginfo_eip(addr, info)
+//
+//	Fill in the 'info' structure with information about the specified
+//	instruction address, 'addr'.  Returns 0 if information was found, and
+//	negative if not.  But even if it returns negative it has stored some
+//	information into '*info'.
+//
+int
+debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
+{
+	const struct KdebugFun *fun;
+	int f, l;
+
+	if (addr < ULIM)
+		return debuginfo_user(addr, info);
+
+	info->eip_file = "<unknown>";
+	info->eip_line = 0;
+	info->eip_fn_name = "<unknown>";
+	info->eip_fn_namelen = 9;
+	info->eip_fn_addr = addr;
+	info->eip_fn_narg = 0;
+
+	if (kdebug_init() < 0)
+		return -1;
+	if ((f = kd_search(kd_funs, kd_nfuns, sizeof(kd_funs[0]), addr)) < 0)
+		return -1;
+	fun = &kd_funs[f];
+	// Outside any function, as in assembly files, report just the
+	// file and line.
+	if (fun->kf_name != KDEBUG_NONAME) {
+		info->eip_fn_name = kd_str + fun->kf_name;
+		info->eip_fn_namelen = fun->kf_namelen;
+		info->eip_fn_addr = fun->kf_addr;
+		info->eip_fn_narg = fun->kf_narg;
+	}
+
+	// The line must belong to this function, or to the stretch of
+	// file text it starts, not to an earlier one.
+	l = kd_search(kd_lines, kd_nlines, sizeof(kd_lines[0]), addr);
+	if (l < 0 || kd_lines[l].kl_addr < fun->kf_addr)
+		return -1;
+	info->eip_file = kd_str + kd_lines[l].kl_file;
+	info->eip_line = kd_lines[l].kl_line;
+	return 0;
+}
@@ -15,6 +15,37 @@ struct Eipdebuginfo {
 	int eip_fn_narg;		// Number of function arguments
 };
 
+// Symbol index searched by debuginfo_eip(): functions and line-number
+// entries, each sorted by address, naming strings by their offset in a
+// string table.  kern/mksymtab.pl generates it from the ELF symbol
+// table and DWARF line program into the .kdebug section, laid out as
+// a KdebugHeader, the functions, the lines, then the strings.
+
+#define KDEBUG_MAGIC	0x4B444247	// "KDBG"
+#define KDEBUG_NONAME	0xFFFFFFFF	// Function name for text outside functions
+
+struct KdebugHeader {
+	uint32_t kh_magic;
+	uint32_t kh_nfuns;
+	uint32_t kh_nlines;
+	uint32_t kh_strsize;
+};
+
+struct KdebugFun {
+	uintptr_t kf_addr;		// First instruction
+	uint32_t kf_name;		// Not null terminated; or KDEBUG_NONAME
+	uint16_t kf_namelen;
+	uint16_t kf_narg;
+};
+
+struct KdebugLine {
+	uintptr_t kl_addr;		// First instruction of the line
+	uint32_t kl_line;
+	uint32_t kl_file;
+};
+
+int kdebug_init(void);
 int debuginfo_eip(uintptr_t eip, struct Eipdebuginfo *info);
+void kdebug_user_flush(physaddr_t cr3);
 
 #endif
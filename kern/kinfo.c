@@ -0,0 +1,51 @@
+// Maintenance of the read-only kernel info page (see inc/kinfo.h).
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/kinfo.h>
+
+// A whole page of its own, so that mapping it into user space
+// exposes nothing else.
+__attribute__((__aligned__(PGSIZE)))
+static uint8_t kinfo_page[PGSIZE];
+
+struct KernInfo * const kinfo = (struct KernInfo *) kinfo_page;
+
+// Writers bracket every update with these so that user-space readers
+// never observe a half-written page.
+static void
+kinfo_write_begin(void)
+{
+	kinfo->ki_seq++;
+	asm volatile("" ::: "memory");
+}
+
+static void
+kinfo_write_end(void)
+{
+	asm volatile("" ::: "memory");
+	kinfo->ki_seq++;
+}
+
+void
+kinfo_init(void)
+{
+	static_assert(sizeof(struct KernInfo) <= PGSIZE);
+
+	memset(kinfo_page, 0, sizeof(kinfo_page));
+	kinfo->ki_tsc_boot = read_tsc();
+	kinfo->ki_ncpu = 1;
+	kinfo->ki_magic = KINFO_MAGIC;
+}
+
+void
+kinfo_set_clock(uint32_t tick_hz, uint32_t tsc_khz)
+{
+	kinfo_write_begin();
+	kinfo->ki_tick_hz = tick_hz;
+	kinfo->ki_tsc_khz = tsc_khz;
+	kinfo_write_end();
+}
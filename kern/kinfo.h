@@ -0,0 +1,20 @@
+#ifndef JOS_KERN_KINFO_H
+#define JOS_KERN_KINFO_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/kinfo.h>
+
+// The kernel's copy of the info page.  It occupies a page-aligned page of
+// its own so that it can be mapped at UKINFO with PTE_U in every environment.
+extern struct KernInfo * const kinfo;
+
+// Nothing keeps ki_ticks, ki_ncpu or ki_cpus current yet: there is no
+// clock interrupt, other CPUs are not started and there are no
+// environments.  Their writers belong with that code when it exists.
+
+void kinfo_init(void);
+void kinfo_set_clock(uint32_t tick_hz, uint32_t tsc_khz);
+
+#endif	// !JOS_KERN_KINFO_H
@@ -0,0 +1,133 @@
+// Deferred binary kernel log; see kern/klog.h.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/stdarg.h>
+#include <inc/x86.h>
+
+#include <kern/klog.h>
+#include <kern/kinfo.h>
+#include <kern/kclock.h>
+#include <kern/apic.h>
+#include <kern/monitor.h>
+
+struct KlogRing {
+	struct KlogRec recs[KLOG_NRECS];
+	uint32_t wpos;			// Records ever written
+};
+
+static struct KlogRing klog_rings[KLOG_NCPU];
+
+// Record one entry.  The variable arguments are not interpreted: the
+// i386 calling convention leaves them contiguous on the stack, so the
+// first 'nbytes' bytes after 'nbytes' are copied as they are.  A record
+// whose arguments do not fit keeps their size but is not replayed.
+void
+klog_record(const char *fmt, size_t nbytes, ...)
+{
+	struct KlogRing *r;
+	struct KlogRec *rec;
+	const uint32_t *args;
+	uint32_t eflags;
+	va_list ap;
+	int cpu, i;
+
+	cpu = lapic_id();
+	eflags = read_eflags();
+	asm volatile("cli");
+
+	r = &klog_rings[cpu % KLOG_NCPU];
+	rec = &r->recs[r->wpos++ % KLOG_NRECS];
+	rec->kr_fmt = fmt;
+	rec->kr_tsc = read_tsc();
+	rec->kr_cpu = cpu;
+	rec->kr_nbytes = nbytes;
+
+	va_start(ap, nbytes);
+	args = (const uint32_t *) ap;
+	for (i = 0; i < MIN(nbytes, sizeof(rec->kr_args)) / 4; i++)
+		rec->kr_args[i] = args[i];
+	va_end(ap);
+
+	write_eflags(eflags);
+}
+
+static void
+klog_print(const struct KlogRec *rec)
+{
+	uint32_t khz = kclock_tsc_khz();
+	uint64_t usec;
+
+	if (khz) {
+		usec = (rec->kr_tsc - kinfo->ki_tsc_boot) * 1000 / khz;
+		cprintf_fast("[%5u.%06u] %u: ", (uint32_t) (usec / 1000000),
+			(uint32_t) (usec % 1000000), rec->kr_cpu);
+	} else
+		cprintf("[%llu] %u: ", rec->kr_tsc, rec->kr_cpu);
+	// The format would read past the arguments that were kept.
+	if (rec->kr_nbytes > sizeof(rec->kr_args)) {
+		cprintf("<record with %u argument bytes not kept>\n",
+			rec->kr_nbytes);
+		return;
+	}
+	// Rebuild the stack image the arguments were copied from.
+	vcprintf(rec->kr_fmt, (va_list) rec->kr_args);
+}
+
+// Format and print every record still held, oldest first, merging the
+// per-CPU rings by timestamp.
+void
+klog_dump(void)
+{
+	uint32_t pos[KLOG_NCPU], end[KLOG_NCPU], lost = 0;
+	const struct KlogRec *rec, *best;
+	int i, besti;
+
+	for (i = 0; i < KLOG_NCPU; i++) {
+		end[i] = klog_rings[i].wpos;
+		pos[i] = end[i] > KLOG_NRECS ? end[i] - KLOG_NRECS : 0;
+		lost += pos[i];
+	}
+	if (lost)
+		cprintf("klog: %u older records overwritten\n", lost);
+
+	while (1) {
+		best = NULL;
+		besti = 0;
+		for (i = 0; i < KLOG_NCPU; i++) {
+			if (pos[i] == end[i])
+				continue;
+			rec = &klog_rings[i].recs[pos[i] % KLOG_NRECS];
+			if (!best || rec->kr_tsc < best->kr_tsc) {
+				best = rec;
+				besti = i;
+			}
+		}
+		if (!best)
+			break;
+		klog_print(best);
+		pos[besti]++;
+	}
+}
+
+void
+klog_clear(void)
+{
+	int i;
+
+	for (i = 0; i < KLOG_NCPU; i++)
+		klog_rings[i].wpos = 0;
+}
+
+static int
+mon_dmesg(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc > 1 && strcmp(argv[1], "clear") == 0) {
+		klog_clear();
+		return 0;
+	}
+	klog_dump();
+	return 0;
+}
+
+MONITOR_COMMAND("dmesg", "Display the deferred kernel log [clear]", mon_dmesg);
@@ -0,0 +1,61 @@
+#ifndef JOS_KERN_KLOG_H
+#define JOS_KERN_KLOG_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Deferred kernel log.  klog() records its format pointer, the TSC, the
+// CPU and the raw argument words into a per-CPU ring without formatting
+// anything; the text is only produced when the log is dumped by the
+// monitor's "dmesg" command or by panic.
+//
+// Because formatting is deferred, the format must be a string literal.
+// A %s argument is kept as a bare pointer and only read when the log is
+// dumped, so it must be a string literal or other static storage, never
+// a stack buffer or one that is later reused.  At most KLOG_ARGWORDS
+// words of arguments are kept; klog() refuses more at compile time.
+
+#define KLOG_NCPU	4		// Rings; CPUs beyond this share them
+#define KLOG_NRECS	128		// Records per ring, a power of 2
+#define KLOG_ARGWORDS	8		// 32-bit argument slots per record
+
+struct KlogRec {
+	const char *kr_fmt;		// cprintf-style format
+	uint64_t kr_tsc;		// read_tsc() when recorded
+	uint16_t kr_cpu;		// lapic_id() of the recording CPU
+	uint16_t kr_nbytes;		// Bytes of kr_args in use
+	uint32_t kr_args[KLOG_ARGWORDS];// Arguments as laid out on the stack
+};
+
+// Stack bytes taken by each (promoted) argument, summed at compile time.
+#define KLOG_SZ(x)		((sizeof((x) + 0) + 3) & ~3)
+#define KLOG_S0(...)		0
+#define KLOG_S1(a)		KLOG_SZ(a)
+#define KLOG_S2(a, ...)		(KLOG_SZ(a) + KLOG_S1(__VA_ARGS__))
+#define KLOG_S3(a, ...)		(KLOG_SZ(a) + KLOG_S2(__VA_ARGS__))
+#define KLOG_S4(a, ...)		(KLOG_SZ(a) + KLOG_S3(__VA_ARGS__))
+#define KLOG_S5(a, ...)		(KLOG_SZ(a) + KLOG_S4(__VA_ARGS__))
+#define KLOG_S6(a, ...)		(KLOG_SZ(a) + KLOG_S5(__VA_ARGS__))
+#define KLOG_S7(a, ...)		(KLOG_SZ(a) + KLOG_S6(__VA_ARGS__))
+#define KLOG_S8(a, ...)		(KLOG_SZ(a) + KLOG_S7(__VA_ARGS__))
+#define KLOG_PICK(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...)	n
+#define KLOG_ARGBYTES(...)						\
+	KLOG_PICK(_0, ##__VA_ARGS__, KLOG_S8, KLOG_S7, KLOG_S6, KLOG_S5,	\
+		  KLOG_S4, KLOG_S3, KLOG_S2, KLOG_S1, KLOG_S0)(__VA_ARGS__)
+
+// Fails to compile (negative array size) if 'nbytes' does not fit.
+#define KLOG_CHECK(nbytes) \
+	((void) sizeof(char[1 - 2 * ((nbytes) > KLOG_ARGWORDS * 4)]))
+
+#define klog(fmt, ...)							\
+	(KLOG_CHECK(KLOG_ARGBYTES(__VA_ARGS__)),			\
+	 klog_record(fmt, KLOG_ARGBYTES(__VA_ARGS__), ##__VA_ARGS__))
+
+void klog_record(const char *fmt, size_t nbytes, ...)
+	__attribute__((format(printf, 1, 3)));
+void klog_dump(void);
+void klog_clear(void);
+
+#endif	// !JOS_KERN_KLOG_H
@@ -0,0 +1,90 @@
+// The local APIC manages internal (non-I/O) interrupts and, with the
+// I/O APIC routing device IRQs to it, replaces the 8259A PIC.
+// See Chapter 10 of Intel's Software Developer's Manual, Volume 3.
+
+#include <inc/x86.h>
+#include <inc/stdio.h>
+
+#include <kern/apic.h>
+
+#define CPUID_FEAT_APIC	0x00000200	// cpuid(1) %edx: on-chip APIC
+
+// Local APIC registers, divided by 4 for use as uint32_t[] indices.
+#define ID	(0x0020/4)	// ID
+#define VER	(0x0030/4)	// Version
+#define TPR	(0x0080/4)	// Task Priority
+#define EOI	(0x00B0/4)	// EOI
+#define SVR	(0x00F0/4)	// Spurious Interrupt Vector
+	#define ENABLE		0x00000100	// Unit Enable
+#define ESR	(0x0280/4)	// Error Status
+#define TIMER	(0x0320/4)	// Local Vector Table 0 (TIMER)
+#define PCINT	(0x0340/4)	// Performance Counter LVT
+#define LINT1	(0x0360/4)	// Local Vector Table 2 (LINT1)
+#define ERROR	(0x0370/4)	// Local Vector Table 3 (ERROR)
+	#define MASKED		0x00010000	// Interrupt masked
+
+bool lapic_present;
+static volatile uint32_t *lapic = (volatile uint32_t *) LAPIC_VA;
+
+static void
+lapicw(int index, int value)
+{
+	lapic[index] = value;
+	lapic[ID];  // wait for write to finish, by reading
+}
+
+void
+lapic_init(void)
+{
+	uint32_t edx;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (!(edx & CPUID_FEAT_APIC)) {
+		cprintf("lapic: no local APIC, keeping the 8259A\n");
+		return;
+	}
+	lapic_present = 1;
+
+	// Enable local APIC; set spurious interrupt vector.
+	lapicw(SVR, ENABLE | (IRQ_OFFSET + IRQ_SPURIOUS));
+
+	// Leave LINT0 as the BIOS set it up: if there is no I/O APIC,
+	// the 8259A still reaches us through it.  Mask the rest.
+	lapicw(LINT1, MASKED);
+	lapicw(TIMER, MASKED);
+
+	// Disable performance counter overflow interrupts
+	// on machines that provide that interrupt entry.
+	if (((lapic[VER]>>16) & 0xFF) >= 4)
+		lapicw(PCINT, MASKED);
+
+	// Map error interrupt to IRQ_ERROR.
+	lapicw(ERROR, IRQ_OFFSET + IRQ_ERROR);
+
+	// Clear error status register (requires back-to-back writes).
+	lapicw(ESR, 0);
+	lapicw(ESR, 0);
+
+	// Ack any outstanding interrupts.
+	lapicw(EOI, 0);
+
+	// Enable interrupts on the APIC (but not on the processor).
+	lapicw(TPR, 0);
+}
+
+int
+lapic_id(void)
+{
+	if (!lapic_present)
+		return 0;
+	return lapic[ID] >> 24;
+}
+
+// Acknowledge interrupt: a single MMIO write, where the 8259A needed
+// an OCW2 to each of the master and slave.
+void
+lapic_eoi(void)
+{
+	if (lapic_present)
+		lapic[EOI] = 0;
+}
@@ -0,0 +1,93 @@
+#!/usr/bin/perl
+#
+# mksymtab.pl nm objdump kernel
+#
+# Write assembly for the kernel's .kdebug section: the function table
+# from the ELF symbol table and the line table from the DWARF line
+# program of 'kernel', in the layout struct KdebugHeader describes in
+# kern/kdebug.h.  kern/Makefrag links the kernel once without the
+# section to run this, then again with its output.
+
+use strict;
+
+my ($nm, $objdump, $kernel) = @ARGV;
+die "usage: mksymtab.pl nm objdump kernel\n" unless defined $kernel;
+
+my $KDEBUG_MAGIC = 0x4B444247;	# "KDBG"
+my $NONAME = 0xFFFFFFFF;
+
+my %strs;
+my $strtab = "";
+sub str {
+	my ($s) = @_;
+	if (!exists $strs{$s}) {
+		$strs{$s} = length($strtab);
+		$strtab .= "$s\0";
+	}
+	return $strs{$s};
+}
+
+# Functions: text symbols, one per address, preferring global names.
+my %funs;
+open(NM, "$nm -n $kernel |") || die "$nm: $!";
+while (<NM>) {
+	next unless /^([0-9a-f]+) ([tT]) (\S+)$/;
+	my ($addr, $type, $name) = (hex($1), $2, $3);
+	next if exists $funs{$addr} && !($type eq 'T' && $funs{$addr}{type} eq 't');
+	$funs{$addr} = { type => $type, name => $name };
+}
+close(NM) || die "$nm failed\n";
+
+# Lines: the last row for each address, with the file in effect.  The
+# start and end of each sequence become nameless functions, so that
+# lines outside any symbol resolve to just their file, and addresses
+# past a file's code do not resolve to its last function.
+my (%lines, %bounds);
+my $file = "<unknown>";
+my $seqstart = 1;
+open(OD, "$objdump --dwarf=decodedline --wide $kernel |") || die "$objdump: $!";
+while (<OD>) {
+	chomp;
+	next if /^Contents of / || /^File name/;
+	if (/^(?:CU: )?(\S+?)(?:\[\+\+\])?:$/) {
+		($file = $1) =~ s,^\./,,;
+	} elsif (/^\S+\s+(\d+)\s+(0x[0-9a-f]+)/) {
+		$lines{hex($2)} = [ $1, $file ];
+		$bounds{hex($2)} = 1 if $seqstart;
+		$seqstart = 0;
+	} elsif (/^\S+\s+-\s+(0x[0-9a-f]+)/) {
+		$bounds{hex($1)} = 1;
+		$seqstart = 1;
+	}
+}
+close(OD) || die "$objdump failed\n";
+
+my @funs;
+for my $addr (keys %bounds) {
+	push @funs, [ $addr, $NONAME, 0 ] unless exists $funs{$addr};
+}
+for my $addr (keys %funs) {
+	my $name = $funs{$addr}{name};
+	push @funs, [ $addr, str($name), length($name) ];
+}
+@funs = sort { $a->[0] <=> $b->[0] } @funs;
+
+my @lines;
+for my $addr (sort { $a <=> $b } keys %lines) {
+	push @lines, [ $addr, $lines{$addr}[0], str($lines{$addr}[1]) ];
+}
+
+print "# Generated by kern/mksymtab.pl from $kernel; do not edit.\n";
+print "\t.section .kdebug, \"a\"\n";
+print "\t.p2align 2\n";
+printf "\t.long 0x%08x, %d, %d, %d\n", $KDEBUG_MAGIC,
+	scalar(@funs), scalar(@lines), length($strtab);
+for my $f (@funs) {
+	printf "\t.long 0x%08x, 0x%08x\n\t.short %d, 0\n", @$f;
+}
+for my $l (@lines) {
+	printf "\t.long 0x%08x, %d, %d\n", @$l;
+}
+for (my $i = 0; $i < length($strtab); $i += 16) {
+	print "\t.byte ", join(", ", map { ord } split(//, substr($strtab, $i, 16))), "\n";
+}
@@ -6,31 +6,102 @@
 #include <inc/memlayout.h>
 #include <inc/assert.h>
 #include <inc/x86.h>
+#include <inc/error.h>
 
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/softirq.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
 
-struct Command {
-	const char *name;
-	const char *desc;
-	// return -1 to force monitor to exit
-	int (*func)(int argc, char** argv, struct Trapframe* tf);
-};
-
 struct Trapframe {
 	uint32_t ebp;
 };
 
-static struct Command commands[] = {
-	{ "help", "Display this list of commands", mon_help },
-	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
-	{ "backtrace", "Display information about the function stack", mon_backtrace },
+MONITOR_COMMAND("help", "Display this list of commands", mon_help);
+MONITOR_COMMAND("kerninfo", "Display information about the kernel", mon_kerninfo);
+MONITOR_COMMAND("backtrace", "Display information about the function stack", mon_backtrace);
+MONITOR_COMMAND("irqstat", "Display per-IRQ counters and bottom-half latency", mon_irqstat);
+MONITOR_COMMAND("console", "List console devices, or turn one on|off", mon_console);
+
+/***** Command table *****/
+
+// Commands are found through an open-addressed hash table of the
+// .moncmd entries, keyed by an FNV-1a hash of the name, which runcmd's
+// tokenizer computes while it scans the first word.  'help' lists
+// them in name order.
+#define MAXCMDS		256
+#define CMDHASH_SIZE	(2 * MAXCMDS)	// power of 2, at most half full
+
+#define FNV_OFFSET	2166136261U
+#define FNV_PRIME	16777619U
+
+struct CmdSlot {
+	const struct Command *cmd;
+	uint32_t hash;
+	uint32_t len;
 };
 
+static struct CmdSlot cmdhash[CMDHASH_SIZE];
+static const struct Command *cmdsorted[MAXCMDS];
+static int ncmds;
+
+static uint32_t
+cmd_hash(const char *s, size_t len)
+{
+	uint32_t h = FNV_OFFSET;
+
+	while (len-- > 0)
+		h = (h ^ (uint8_t) *s++) * FNV_PRIME;
+	return h;
+}
+
+static void
+cmdtab_init(void)
+{
+	extern const struct Command __MONCMD_BEGIN__[], __MONCMD_END__[];
+	const struct Command *c;
+	struct CmdSlot *slot;
+	uint32_t h, len, j;
+	int i;
+
+	for (c = __MONCMD_BEGIN__; c < __MONCMD_END__; c++) {
+		if (ncmds == MAXCMDS)
+			panic("more than %d monitor commands", MAXCMDS);
+		len = strlen(c->name);
+		h = cmd_hash(c->name, len);
+		for (j = h; (slot = &cmdhash[j % CMDHASH_SIZE])->cmd; j++)
+			if (slot->hash == h && slot->len == len
+			    && memcmp(slot->cmd->name, c->name, len) == 0)
+				panic("monitor command '%s' registered twice", c->name);
+		slot->cmd = c;
+		slot->hash = h;
+		slot->len = len;
+
+		// Insertion sort; this runs once, over a few hundred at most.
+		for (i = ncmds++; i > 0 && strcmp(cmdsorted[i - 1]->name, c->name) > 0; i--)
+			cmdsorted[i] = cmdsorted[i - 1];
+		cmdsorted[i] = c;
+	}
+}
+
+static const struct Command *
+cmd_lookup(const char *name, size_t len, uint32_t h)
+{
+	struct CmdSlot *slot;
+	uint32_t i;
+
+	if (ncmds == 0)
+		cmdtab_init();
+	for (i = h; (slot = &cmdhash[i % CMDHASH_SIZE])->cmd; i++)
+		if (slot->hash == h && slot->len == len
+		    && memcmp(slot->cmd->name, name, len) == 0)
+			return slot->cmd;
+	return NULL;
+}
+
 /***** Implementations of basic kernel monitor commands *****/
 
 int
@@ -38,8 +109,10 @@ mon_help(int argc, char **argv, struct Trapframe *tf)
 {
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(commands); i++)
-		cprintf("%s - %s\n", commands[i].name, commands[i].desc);
+	if (ncmds == 0)
+		cmdtab_init();
+	for (i = 0; i < ncmds; i++)
+		cprintf("%s - %s\n", cmdsorted[i]->name, cmdsorted[i]->desc);
 	return 0;
 }
 
@@ -49,11 +122,15 @@ mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 	extern char _start[], entry[], etext[], edata[], end[];
 
 	cprintf("Special kernel symbols:\n");
-	cprintf("  _start                  %08x (phys)\n", _start);
-	cprintf("  entry  %08x (virt)  %08x (phys)\n", entry, entry - KERNBASE);
-	cprintf("  etext  %08x (virt)  %08x (phys)\n", etext, etext - KERNBASE);
-	cprintf("  edata  %08x (virt)  %08x (phys)\n", edata, edata - KERNBASE);
-	cprintf("  end    %08x (virt)  %08x (phys)\n", end, end - KERNBASE);
+	cprintf("  _start                  %08x (phys)\n", (uint32_t) _start);
+	cprintf("  entry  %08x (virt)  %08x (phys)\n",
+		(uint32_t) entry, (uint32_t) entry - KERNBASE);
+	cprintf("  etext  %08x (virt)  %08x (phys)\n",
+		(uint32_t) etext, (uint32_t) etext - KERNBASE);
+	cprintf("  edata  %08x (virt)  %08x (phys)\n",
+		(uint32_t) edata, (uint32_t) edata - KERNBASE);
+	cprintf("  end    %08x (virt)  %08x (phys)\n",
+		(uint32_t) end, (uint32_t) end - KERNBASE);
 	cprintf("Kernel executable memory footprint: %dKB\n",
 		ROUNDUP(end - entry, 1024) / 1024);
 	return 0;
@@ -83,8 +160,8 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 	new_tf.ebp = (uint32_t)(*((uint32_t *)ebp));
 
 	// print current stack trace
-	cprintf(" ebp %08x  eip %08x  args %08x %08x %08x %08x %08x\n", (void *)ebp, (void *)eip, 
-		(void *)arglist[0], (void *)arglist[1], (void *)arglist[2], (void *)arglist[3], (void *)arglist[4]);
+	cprintf(" ebp %08x  eip %08x  args %08x %08x %08x %08x %08x\n", ebp, eip,
+		arglist[0], arglist[1], arglist[2], arglist[3], arglist[4]);
 
 	struct Eipdebuginfo info;
 	uintptr_t addr;
@@ -103,62 +180,409 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 	return 0;
 }
 
+int
+mon_irqstat(int argc, char **argv, struct Trapframe *tf)
+{
+	irqstat_print();
+	return 0;
+}
+
+int
+mon_console(int argc, char **argv, struct Trapframe *tf)
+{
+	int r;
+
+	if (argc == 1) {
+		cons_sink_print();
+		return 0;
+	}
+	if (argc != 3 || (strcmp(argv[2], "on") != 0 && strcmp(argv[2], "off") != 0)) {
+		cprintf("Usage: console [device on|off]\n");
+		return 0;
+	}
+	if ((r = cons_sink_enable(argv[1], strcmp(argv[2], "on") == 0)) < 0)
+		cprintf("console: cannot turn %s %s: %s\n", argv[1], argv[2], strerror(r));
+	return 0;
+}
 
 
 /***** Kernel monitor command interpreter *****/
 
-#define WHITESPACE "\t\r\n "
+// A command line may hold several commands separated by ';' (or by
+// newlines, in scripts).  Any argument of the form $name is replaced by
+// the value of a variable defined with
+//
+//	set [name [value]]	list, define or remove a variable
+//
+// except under
+//
+//	repeat N cmd args...	run 'cmd' N times, with $i set to 0..N-1
+//
+// which the interpreter runs before expanding anything, so that the
+// repeated command's arguments are expanded afresh on every pass.
+//
+// In batch mode (see 'batch' and 'script') nothing is echoed or
+// prompted for, and each command's output is framed for a program
+// to parse:
+//
+//	@@begin <seq> <name>
+//	...output...
+//	@@end <seq> <return value> <cycles>
+
 #define MAXARGS 16
+#define MAXVARS 16
+#define VARNAME_SIZE	16
+#define VARVAL_SIZE	64
+#define SCRIPT_SIZE	4096
+
+// Character classes for the tokenizer; everything else is part of a word.
+enum {
+	CC_WORD = 0,
+	CC_SPACE,
+	CC_SEP,
+	CC_END,
+};
+
+static const uint8_t cclass[256] = {
+	['\0'] = CC_END,
+	['\t'] = CC_SPACE,
+	['\r'] = CC_SPACE,
+	['\n'] = CC_SEP,
+	[' '] = CC_SPACE,
+	[';'] = CC_SEP,
+};
+
+struct MonVar {
+	char name[VARNAME_SIZE];
+	char value[VARVAL_SIZE];
+};
+
+static struct MonVar monvars[MAXVARS];
+static bool mon_batch;
+static uint32_t mon_seq;
+
+static struct MonVar *
+var_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < MAXVARS; i++)
+		if (monvars[i].name[0] && strcmp(monvars[i].name, name) == 0)
+			return &monvars[i];
+	return NULL;
+}
+
+static int
+var_set(const char *name, const char *value)
+{
+	struct MonVar *v;
+	int i;
+
+	if (strlen(name) >= VARNAME_SIZE || strlen(value) >= VARVAL_SIZE)
+		return -E_INVAL;
+	if ((v = var_find(name)) == NULL) {
+		for (i = 0; i < MAXVARS && monvars[i].name[0]; i++)
+			;
+		if (i == MAXVARS)
+			return -E_NO_MEM;
+		v = &monvars[i];
+		strcpy(v->name, name);
+	}
+	strcpy(v->value, value);
+	return 0;
+}
 
+// Replace '*arg' by the value of the variable it names, if it is $name.
+// Returns 0, or -1 if there is no such variable.
+static int
+var_expand(char **arg)
+{
+	struct MonVar *v;
+
+	if ((*arg)[0] != '$')
+		return 0;
+	if ((v = var_find(*arg + 1)) == NULL) {
+		cprintf("Undefined variable '%s'\n", *arg);
+		return -1;
+	}
+	*arg = v->value;
+	return 0;
+}
+
+static int
+mon_set(int argc, char **argv, struct Trapframe *tf)
+{
+	struct MonVar *v;
+	int i, r;
+
+	if (argc == 1) {
+		for (i = 0; i < MAXVARS; i++)
+			if (monvars[i].name[0])
+				cprintf("%s=%s\n", monvars[i].name, monvars[i].value);
+		return 0;
+	}
+	if (argc == 2) {
+		if ((v = var_find(argv[1])) != NULL)
+			v->name[0] = 0;
+		return 0;
+	}
+	if ((r = var_set(argv[1], argv[2])) < 0)
+		cprintf("set: %s: %s\n", argv[1], strerror(r));
+	return 0;
+}
+
+static int runargs(int argc, char **argv, uint32_t h, size_t len0,
+		   struct Trapframe *tf);
+
+// Called with its arguments unexpanded; see runargs().
+static int
+mon_repeat(int argc, char **argv, struct Trapframe *tf)
+{
+	char *args[MAXARGS];
+	char num[12];
+	long i, n;
+	int r;
+
+	if (argc >= 3 && var_expand(&argv[1]) < 0)
+		return 0;
+	if (argc < 3 || (n = strtol(argv[1], NULL, 0)) <= 0) {
+		cprintf("Usage: repeat N command [args...]\n");
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		snprintf(num, sizeof(num), "%ld", i);
+		var_set("i", num);
+		memcpy(args, argv + 2, (argc - 1) * sizeof(argv[0]));
+		if ((r = runargs(argc - 2, args, cmd_hash(args[0], strlen(args[0])),
+				 strlen(args[0]), tf)) < 0)
+			return r;
+	}
+	return 0;
+}
+
+// Run one parsed command.  'h' and 'len0' describe argv[0] as the
+// tokenizer hashed it; they are recomputed if argv[0] changes.
+static int
+runargs(int argc, char **argv, uint32_t h, size_t len0, struct Trapframe *tf)
+{
+	const struct Command *cmd;
+	uint64_t t0;
+	int i, r;
+
+	// 'repeat' goes first, so that $i is expanded on every pass.
+	if (strcmp(argv[0], "repeat") == 0)
+		return mon_repeat(argc, argv, tf);
+
+	for (i = 0; i < argc; i++) {
+		if (argv[i][0] != '$')
+			continue;
+		if (var_expand(&argv[i]) < 0)
+			return 0;
+		if (i == 0) {
+			len0 = strlen(argv[0]);
+			h = cmd_hash(argv[0], len0);
+		}
+	}
+
+	if ((cmd = cmd_lookup(argv[0], len0, h)) == NULL) {
+		cprintf("Unknown command '%s'\n", argv[0]);
+		return 0;
+	}
+	if (!mon_batch)
+		return cmd->func(argc, argv, tf);
+
+	cprintf("@@begin %u %s\n", mon_seq, cmd->name);
+	t0 = read_tsc();
+	r = cmd->func(argc, argv, tf);
+	cprintf("@@end %u %d %llu\n", mon_seq++, r, read_tsc() - t0);
+	return r;
+}
+
+int
+monitor_runargs(int argc, char **argv, struct Trapframe *tf)
+{
+	size_t len0 = strlen(argv[0]);
+
+	return runargs(argc, argv, cmd_hash(argv[0], len0), len0, tf);
+}
+
+// Run every command in 'buf', which is modified in place.
+// Stops early, returning the value, if a command returns < 0.
 static int
 runcmd(char *buf, struct Trapframe *tf)
 {
-	int argc;
+	int argc, r;
 	char *argv[MAXARGS];
-	int i;
+	uint32_t h;
+	size_t len0;
+
+	while (*buf) {
+		// Parse the next command into whitespace-separated
+		// arguments, hashing the first one on the way
+		argc = 0;
+		h = FNV_OFFSET;
+		len0 = 0;
+		while (1) {
+			// gobble whitespace
+			while (cclass[(uint8_t) *buf] == CC_SPACE)
+				*buf++ = 0;
+			if (cclass[(uint8_t) *buf] != CC_WORD)
+				break;
 
-	// Parse the command buffer into whitespace-separated arguments
-	argc = 0;
-	argv[argc] = 0;
-	while (1) {
-		// gobble whitespace
-		while (*buf && strchr(WHITESPACE, *buf))
+			// save and scan past next arg
+			if (argc == MAXARGS-1) {
+				cprintf("Too many arguments (max %d)\n", MAXARGS);
+				argc = -1;
+				while (cclass[(uint8_t) *buf] != CC_SEP
+				       && cclass[(uint8_t) *buf] != CC_END)
+					buf++;
+				break;
+			}
+			argv[argc++] = buf;
+			if (argc == 1) {
+				for (; cclass[(uint8_t) *buf] == CC_WORD; buf++)
+					h = (h ^ (uint8_t) *buf) * FNV_PRIME;
+				len0 = buf - argv[0];
+			} else
+				while (cclass[(uint8_t) *buf] == CC_WORD)
+					buf++;
+		}
+		if (cclass[(uint8_t) *buf] == CC_SEP)
 			*buf++ = 0;
-		if (*buf == 0)
-			break;
+		if (argc <= 0)
+			continue;
+		argv[argc] = 0;
+
+		if ((r = runargs(argc, argv, h, len0, tf)) < 0)
+			return r;
+	}
+	return 0;
+}
+
+// Batches do not nest: the outer one is still tokenizing its script
+// buffer, which the inner one would overwrite, and a script that ran
+// itself would recurse until the stack overflowed.
+static bool
+batch_refused(const char *cmd)
+{
+	if (mon_batch)
+		cprintf("%s: not allowed inside a batch or script\n", cmd);
+	return mon_batch;
+}
+
+// Run 'script' in batch mode, bracketed by @@batch and @@done lines.
+static int
+runbatch(char *script, struct Trapframe *tf)
+{
+	bool batch = mon_batch;
+	int r;
+
+	cprintf("@@batch %u\n", mon_seq);
+	mon_batch = true;
+	r = runcmd(script, tf);
+	mon_batch = batch;
+	cprintf("@@done %d\n", r);
+	return r;
+}
+
+// Read and throw away console lines up to one holding only ".".
+// 'bol' says whether the next read starts a line.
+static void
+batch_discard(char *buf, size_t size, bool bol)
+{
+	int r;
+
+	while (1) {
+		r = cons_read(buf, size - 1);
+		buf[r] = 0;
+		if (bol && strcmp(buf, ".\n") == 0)
+			return;
+		bol = r > 0 && buf[r - 1] == '\n';
+	}
+}
 
-		// save and scan past next arg
-		if (argc == MAXARGS-1) {
-			cprintf("Too many arguments (max %d)\n", MAXARGS);
+// Read a script from the console, a line at a time without echo,
+// up to a line holding only ".", then run it in batch mode.
+static int
+mon_batchcmd(int argc, char **argv, struct Trapframe *tf)
+{
+	static char script[SCRIPT_SIZE];
+	size_t n = 0;
+	int r;
+
+	if (batch_refused(argv[0]))
+		return 0;
+	cons_setmode(CONS_ICANON);
+	cprintf("@@ready\n");
+	cons_flush();
+	while (1) {
+		if (n == SCRIPT_SIZE - 1) {
+			cprintf("@@error script longer than %d bytes\n", SCRIPT_SIZE - 1);
+			// Read to the end of the script anyway, so that its
+			// remaining lines do not run as commands.
+			batch_discard(script, SCRIPT_SIZE, script[n - 1] == '\n');
+			cons_setmode(0);
 			return 0;
 		}
-		argv[argc++] = buf;
-		while (*buf && !strchr(WHITESPACE, *buf))
-			buf++;
+		r = cons_read(script + n, SCRIPT_SIZE - 1 - n);
+		script[n + r] = 0;
+		if (strcmp(script + n, ".\n") == 0)
+			break;
+		n += r;
 	}
-	argv[argc] = 0;
+	cons_setmode(0);
+	script[n] = 0;
+	return runbatch(script, tf);
+}
 
-	// Lookup and invoke the command
-	if (argc == 0)
+// List the embedded scripts, or run one in batch mode.
+static int
+mon_script(int argc, char **argv, struct Trapframe *tf)
+{
+	extern const struct MonScript __MONSCRIPT_BEGIN__[], __MONSCRIPT_END__[];
+	static char script[SCRIPT_SIZE];
+	const struct MonScript *s;
+
+	for (s = __MONSCRIPT_BEGIN__; s < __MONSCRIPT_END__; s++) {
+		if (argc == 1)
+			cprintf("%s: %s\n", s->name, s->text);
+		else if (strcmp(s->name, argv[1]) == 0)
+			break;
+	}
+	if (argc == 1 || batch_refused(argv[0]))
+		return 0;
+	if (s == __MONSCRIPT_END__) {
+		cprintf("script: no script '%s'\n", argv[1]);
 		return 0;
-	for (i = 0; i < ARRAY_SIZE(commands); i++) {
-		if (strcmp(argv[0], commands[i].name) == 0)
-			return commands[i].func(argc, argv, tf);
 	}
-	cprintf("Unknown command '%s'\n", argv[0]);
-	return 0;
+	if (strlen(s->text) >= SCRIPT_SIZE) {
+		cprintf("script: '%s' is longer than %d bytes\n", s->name, SCRIPT_SIZE - 1);
+		return 0;
+	}
+	strcpy(script, s->text);
+	return runbatch(script, tf);
 }
 
+MONITOR_COMMAND("set", "List variables, or set or remove one: set [name [value]]", mon_set);
+MONITOR_COMMAND("repeat", "Run a command N times with $i counting: repeat N command [args...]", mon_repeat);
+MONITOR_COMMAND("batch", "Read commands up to a '.' line and run them with framed output", mon_batchcmd);
+MONITOR_COMMAND("script", "List embedded scripts, or run one in batch mode", mon_script);
+MONITOR_SCRIPT(health, "kerninfo; irqstat; console; dmesg");
+
 void
 monitor(struct Trapframe *tf)
 {
 	char *buf;
 
+	// From here on every wait for input flushes, so buffer output.
+	cons_async();
 	cprintf("Welcome to the JOS kernel monitor!\n");
 	cprintf("Type 'help' for a list of commands.\n");
 
 
 	while (1) {
+		// Show everything printed so far before waiting for input.
+		cons_flush();
 		buf = readline("K> ");
 		if (buf != NULL)
 			if (runcmd(buf, tf) < 0)
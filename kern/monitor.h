@@ -6,14 +6,46 @@
 
 struct Trapframe;
 
+struct Command {
+	const char *name;
+	const char *desc;
+	// return -1 to force monitor to exit
+	int (*func)(int argc, char** argv, struct Trapframe* tf);
+};
+
+// Register a monitor command from any kernel source file.  The entries
+// are collected by the linker into the .moncmd section (see kernel.ld)
+// and indexed by the monitor the first time it runs a command.
+#define MONITOR_COMMAND(name, desc, func)				\
+	static const struct Command __moncmd_##func			\
+	__attribute__((section(".moncmd"), used, aligned(4))) =	\
+		{ name, desc, func }
+
+struct MonScript {
+	const char *name;
+	const char *text;	// Commands separated by ';' or newlines
+};
+
+// Embed a monitor script, run in batch mode by 'script <name>'.
+// The entries are collected by the linker into the .monscript section.
+#define MONITOR_SCRIPT(name, text)					\
+	static const struct MonScript __monscript_##name		\
+	__attribute__((section(".monscript"), used, aligned(4))) =	\
+		{ #name, text }
+
 // Activate the kernel monitor,
 // optionally providing a trap frame indicating the current state
 // (NULL if none).
 void monitor(struct Trapframe *tf);
 
+// Run one command from its arguments, as if typed at the monitor.
+int monitor_runargs(int argc, char **argv, struct Trapframe *tf);
+
 // Functions implementing monitor commands.
 int mon_help(int argc, char **argv, struct Trapframe *tf);
 int mon_kerninfo(int argc, char **argv, struct Trapframe *tf);
 int mon_backtrace(int argc, char **argv, struct Trapframe *tf);
+int mon_irqstat(int argc, char **argv, struct Trapframe *tf);
+int mon_console(int argc, char **argv, struct Trapframe *tf);
 
 #endif	// !JOS_KERN_MONITOR_H
@@ -0,0 +1,184 @@
+// Architectural performance counters; see kern/pmu.h.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/mmu.h>
+#include <inc/x86.h>
+
+#include <kern/pmu.h>
+#include <kern/monitor.h>
+
+#define MSR_PMC0		0x0C1	// General-purpose counters
+#define MSR_PERFEVTSEL0		0x186	// Their event selects
+#define MSR_FIXED_CTR0		0x309	// Fixed counter 0: instructions
+#define MSR_FIXED_CTR_CTRL	0x38D
+#define MSR_PERF_GLOBAL_CTRL	0x38F	// Architectural version 2 and up
+
+#define EVTSEL_USR		0x00010000	// Count in ring 3
+#define EVTSEL_OS		0x00020000	// Count in ring 0
+#define EVTSEL_EN		0x00400000	// Enable
+
+#define FIXED_CTRL_OS		0x1	// Per fixed counter, 4 bits each
+#define FIXED_CTRL_USR		0x2
+
+#define RDPMC_FIXED		0x40000000
+
+static const struct {
+	const char *name;
+	uint32_t unavail;	// cpuid(0xA) %ebx bit set if not supported
+	uint32_t evtsel;	// Umask and event select
+	int fixed;		// Fixed counter that counts it, or -1
+} pmu_events[PMU_NEVENTS] = {
+	[PMU_CYCLES]		= { "cycles",		0, 0x003C, 1 },
+	[PMU_INSTRS]		= { "instructions",	1, 0x00C0, 0 },
+	[PMU_LLC_REFS]		= { "llc-refs",		3, 0x4F2E, -1 },
+	[PMU_LLC_MISSES]	= { "llc-misses",	4, 0x412E, -1 },
+	[PMU_BRANCHES]		= { "branches",		5, 0x00C4, -1 },
+	[PMU_BRANCH_MISSES]	= { "branch-misses",	6, 0x00C5, -1 },
+};
+
+static struct {
+	int version;			// Architectural PMU version; 0 if none
+	int ngp, nfixed;		// Counters of each kind
+	uint32_t rdpmc[PMU_NEVENTS];	// rdpmc index of each event's counter
+	uint64_t mask[PMU_NEVENTS];	// Width mask; 0 if not counted
+} pmu;
+
+// Detect the PMU and start every supported event counting.
+// Returns whether any event is being counted.
+bool
+pmu_init(void)
+{
+	uint32_t eax, ebx, edx, maxleaf, nbits, gpbits, fixbits = 0;
+	uint64_t gctrl = 0, fctrl = 0;
+	int i, gp = 0;
+
+	cpuid(0, &maxleaf, NULL, NULL, NULL);
+	if (maxleaf < 0xA)
+		return false;
+	cpuid(0xA, &eax, &ebx, NULL, &edx);
+	pmu.version = eax & 0xFF;
+	pmu.ngp = (eax >> 8) & 0xFF;
+	gpbits = (eax >> 16) & 0xFF;
+	nbits = (eax >> 24) & 0xFF;
+	if (pmu.version == 0 || pmu.ngp == 0)
+		return false;
+	if (pmu.version >= 2) {
+		pmu.nfixed = edx & 0x1F;
+		fixbits = (edx >> 5) & 0xFF;
+	}
+
+	for (i = 0; i < PMU_NEVENTS; i++) {
+		if (pmu_events[i].unavail >= nbits
+		    || (ebx & (1 << pmu_events[i].unavail)))
+			continue;
+		if (pmu_events[i].fixed >= 0 && pmu_events[i].fixed < pmu.nfixed) {
+			// Fixed counters leave the general ones for the rest.
+			wrmsr(MSR_FIXED_CTR0 + pmu_events[i].fixed, 0);
+			fctrl |= (uint64_t) (FIXED_CTRL_OS | FIXED_CTRL_USR)
+				<< (4 * pmu_events[i].fixed);
+			gctrl |= 1ULL << (32 + pmu_events[i].fixed);
+			pmu.rdpmc[i] = RDPMC_FIXED | pmu_events[i].fixed;
+			pmu.mask[i] = (1ULL << fixbits) - 1;
+		} else if (gp < pmu.ngp) {
+			wrmsr(MSR_PMC0 + gp, 0);
+			wrmsr(MSR_PERFEVTSEL0 + gp, pmu_events[i].evtsel
+			      | EVTSEL_USR | EVTSEL_OS | EVTSEL_EN);
+			gctrl |= 1ULL << gp;
+			pmu.rdpmc[i] = gp++;
+			pmu.mask[i] = (1ULL << gpbits) - 1;
+		}
+	}
+	if (pmu.nfixed)
+		wrmsr(MSR_FIXED_CTR_CTRL, fctrl);
+	if (pmu.version >= 2)
+		wrmsr(MSR_PERF_GLOBAL_CTRL, gctrl);
+
+	// Let environments read the counters too.
+	lcr4(rcr4() | CR4_PCE);
+	return gctrl != 0;
+}
+
+// Read every counted event; the others read as 0.
+void
+pmu_read(struct PmuCounts *pc)
+{
+	int i;
+
+	for (i = 0; i < PMU_NEVENTS; i++)
+		pc->pc_count[i] = pmu.mask[i] ? rdpmc(pmu.rdpmc[i]) & pmu.mask[i] : 0;
+}
+
+// Add the events since '*since' to '*acc', and restart '*since' now.
+void
+pmu_account(struct PmuCounts *acc, struct PmuCounts *since)
+{
+	struct PmuCounts now;
+	int i;
+
+	pmu_read(&now);
+	for (i = 0; i < PMU_NEVENTS; i++)
+		acc->pc_count[i] += (now.pc_count[i] - since->pc_count[i]) & pmu.mask[i];
+	*since = now;
+}
+
+// Print 'n' / 'total' * 'scale' with two decimals.
+static void
+print_ratio(const char *what, uint64_t n, uint64_t total, uint32_t scale)
+{
+	uint32_t r;
+
+	if (total == 0)
+		return;
+	r = n * scale * 100 / total;
+	cprintf("  # %u.%02u%s", r / 100, r % 100, what);
+}
+
+static int
+mon_perf(int argc, char **argv, struct Trapframe *tf)
+{
+	struct PmuCounts start, total;
+	uint64_t tsc;
+	int i, r = 0;
+
+	if (pmu.version == 0) {
+		cprintf("perf: no architectural performance counters\n");
+		return 0;
+	}
+	if (argc == 1) {
+		cprintf("PMU version %d, %d general counters, %d fixed\n",
+			pmu.version, pmu.ngp, pmu.nfixed);
+		for (i = 0; i < PMU_NEVENTS; i++)
+			cprintf("  %-14s %s\n", pmu_events[i].name,
+				pmu.mask[i] ? "counting" : "not supported");
+		cprintf("Usage: perf command [args...]\n");
+		return 0;
+	}
+
+	memset(&total, 0, sizeof(total));
+	tsc = read_tsc();
+	pmu_read(&start);
+	r = monitor_runargs(argc - 1, argv + 1, tf);
+	pmu_account(&total, &start);
+	tsc = read_tsc() - tsc;
+
+	cprintf("%16llu  tsc\n", tsc);
+	for (i = 0; i < PMU_NEVENTS; i++) {
+		if (!pmu.mask[i])
+			continue;
+		cprintf("%16llu  %-14s", total.pc_count[i], pmu_events[i].name);
+		if (i == PMU_INSTRS)
+			print_ratio(" insn per cycle",
+				    total.pc_count[i], total.pc_count[PMU_CYCLES], 1);
+		else if (i == PMU_LLC_MISSES)
+			print_ratio("% of llc-refs",
+				    total.pc_count[i], total.pc_count[PMU_LLC_REFS], 100);
+		else if (i == PMU_BRANCH_MISSES)
+			print_ratio("% of branches",
+				    total.pc_count[i], total.pc_count[PMU_BRANCHES], 100);
+		cprintf("\n");
+	}
+	return r;
+}
+
+MONITOR_COMMAND("perf", "Count cycles, instructions and misses while running a command", mon_perf);
@@ -0,0 +1,35 @@
+#ifndef JOS_KERN_PMU_H
+#define JOS_KERN_PMU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Architectural performance monitoring (cpuid leaf 0xA).  pmu_init()
+// programs one counter per event below, counting in both rings, and
+// leaves them running; readers take differences of pmu_read() values.
+//
+// To count per environment, a context switch would pmu_read() the
+// counters when an environment starts running and charge it with
+// pmu_account() when it stops.
+
+enum {
+	PMU_CYCLES = 0,		// Unhalted core cycles
+	PMU_INSTRS,		// Instructions retired
+	PMU_LLC_REFS,		// Last-level cache references
+	PMU_LLC_MISSES,		// Last-level cache misses
+	PMU_BRANCHES,		// Branch instructions retired
+	PMU_BRANCH_MISSES,	// Mispredicted branches retired
+	PMU_NEVENTS
+};
+
+struct PmuCounts {
+	uint64_t pc_count[PMU_NEVENTS];
+};
+
+bool pmu_init(void);
+void pmu_read(struct PmuCounts *pc);
+void pmu_account(struct PmuCounts *acc, struct PmuCounts *since);
+
+#endif	// !JOS_KERN_PMU_H
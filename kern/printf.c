@@ -1,5 +1,5 @@
 // Simple implementation of cprintf console output for the kernel,
-// based on printfmt() and the kernel console's cputchar().
+// based on vwprintfmt() and the kernel console's cwrite().
 
 #include <inc/types.h>
 #include <inc/stdio.h>
@@ -7,10 +7,10 @@
 
 
 static void
-putch(int ch, int *cnt)
+putbuf(const char *buf, size_t len, int *cnt)
 {
-	cputchar(ch);
-	*cnt++;
+	cwrite(buf, len);
+	*cnt += len;
 }
 
 int
@@ -18,7 +18,29 @@ vcprintf(const char *fmt, va_list ap)
 {
 	int cnt = 0;
 
-	vprintfmt((void*)putch, &cnt, fmt, ap);
+	vwprintfmt((void*)putbuf, &cnt, fmt, ap);
+	return cnt;
+}
+
+// Print through a compiled copy of fmt, compiling it on first use.
+int
+cprintf_prog(struct printfmt_prog *prog, const char *fmt, ...)
+{
+	va_list ap;
+	int cnt = 0;
+
+	if (prog->fmt != fmt && printfmt_compile(prog, fmt) < 0)
+		cprintf("cprintf_fast: \"%s\" not compiled: more than %d "
+			"conversions, '*' or an unknown escape\n",
+			fmt, PRINTFMT_MAXDIRS - 1);
+
+	va_start(ap, fmt);
+	if (prog->ndirs < 0)
+		cnt = vcprintf(fmt, ap);
+	else
+		vwprintfmt_prog((void*)putbuf, &cnt, prog, ap);
+	va_end(ap);
+
 	return cnt;
 }
 
@@ -0,0 +1,316 @@
+// Statistical kernel profiler; see kern/profile.h.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+
+#include <kern/profile.h>
+#include <kern/kdebug.h>
+#include <kern/kclock.h>
+#include <kern/apic.h>
+#include <kern/monitor.h>
+
+#define PROF_PERIOD_USEC	1000	// Default time between samples
+#define PROF_MAXFNS		256	// Distinct functions in a report
+#define PROF_MAXSTACKS		256	// Distinct stacks in a folded report
+
+struct ProfSample {
+	uintptr_t ps_pc[PROF_DEPTH];	// Interrupted EIP, then return addresses
+	uint32_t ps_depth;
+};
+
+struct ProfBuf {
+	struct ProfSample samples[PROF_NSAMPLES];
+	uint32_t nsamples;
+	uint32_t dropped;		// Samples lost because the buffer was full
+};
+
+static struct ProfBuf prof_bufs[PROF_NCPU];
+
+static struct {
+	bool on;
+	uint64_t period;		// TSC cycles between polled samples
+	uint64_t next;			// TSC of the next polled sample
+	uint64_t start, stop;		// TSC when profiling started and stopped
+	uint32_t npolled;		// Samples taken by profile_poll()
+} prof;
+
+// Is 'ebp' a plausible kernel frame pointer?  Frames are only
+// followed within the kernel's own mapping, so a corrupt chain ends
+// the walk instead of faulting.
+static bool
+frame_ok(uintptr_t ebp)
+{
+	return ebp != 0 && ebp % 4 == 0
+		&& ebp >= KERNBASE && ebp <= KERNBASE + PTSIZE - 8;
+}
+
+void
+profile_tick(uintptr_t eip, uintptr_t ebp)
+{
+	struct ProfBuf *b;
+	struct ProfSample *s;
+	uintptr_t prev;
+	int n;
+
+	if (!prof.on)
+		return;
+	b = &prof_bufs[lapic_id() % PROF_NCPU];
+	if (b->nsamples == PROF_NSAMPLES) {
+		b->dropped++;
+		return;
+	}
+
+	s = &b->samples[b->nsamples++];
+	s->ps_pc[0] = eip;
+	for (n = 1; n < PROF_DEPTH && frame_ok(ebp); n++) {
+		s->ps_pc[n] = ((uint32_t *) ebp)[1];
+		prev = ebp;
+		ebp = ((uint32_t *) ebp)[0];
+		// Stacks grow down, so callers' frames lie above.
+		if (ebp <= prev)
+			ebp = 0;
+	}
+	s->ps_depth = n;
+}
+
+void
+profile_poll(void)
+{
+	uintptr_t ebp;
+	uint64_t now;
+
+	if (!prof.on || (now = read_tsc()) < prof.next)
+		return;
+	prof.next = now + prof.period;
+	prof.npolled++;
+
+	// Sample our caller, as an interrupt taken on its return would.
+	ebp = read_ebp();
+	profile_tick(((uint32_t *) ebp)[1], ((uint32_t *) ebp)[0]);
+}
+
+static void
+profile_start(uint32_t usec)
+{
+	uint32_t khz = kclock_tsc_khz();
+	int i;
+
+	for (i = 0; i < PROF_NCPU; i++) {
+		prof_bufs[i].nsamples = 0;
+		prof_bufs[i].dropped = 0;
+	}
+	// Without a calibrated TSC, assume 1GHz.
+	prof.period = (uint64_t) usec * (khz ? khz : 1000000) / 1000;
+	prof.start = read_tsc();
+	prof.next = prof.start + prof.period;
+	prof.npolled = 0;
+	prof.on = 1;
+	cprintf("profile: experimental; with no timer interrupt, only console\n"
+		"polling is sampled\n");
+}
+
+static void
+profile_stop(void)
+{
+	if (prof.on)
+		prof.stop = read_tsc();
+	prof.on = 0;
+}
+
+/***** Reports *****/
+
+struct ProfFn {
+	uintptr_t pf_addr;		// Function start, or the pc if unknown
+	const char *pf_name;
+	int pf_namelen;
+	uint32_t pf_self;		// Samples with this function at the leaf
+	uint32_t pf_total;		// Samples with it anywhere on the stack
+	uint32_t pf_last;		// Last sample counted in pf_total
+};
+
+struct ProfStack {
+	uint16_t pk_fn[PROF_DEPTH];	// Indexes into prof_fns, leaf first
+	uint32_t pk_depth;
+	uint32_t pk_hash;
+	uint32_t pk_count;
+};
+
+static struct ProfFn prof_fns[PROF_MAXFNS];
+static int prof_nfns;
+static uint16_t prof_fnhash[2 * PROF_MAXFNS];	// Index + 1; 0 if empty
+
+// Find or add the function containing 'pc'.
+// Returns its index, or -1 if the table is full.
+static int
+prof_fn(uintptr_t pc)
+{
+	struct Eipdebuginfo info;
+	struct ProfFn *f;
+	uint32_t h, i;
+
+	if (debuginfo_eip(pc, &info) < 0) {
+		info.eip_fn_addr = pc;
+		info.eip_fn_name = "<unknown>";
+		info.eip_fn_namelen = 9;
+	}
+	h = info.eip_fn_addr * 2654435761U;
+	for (i = h >> 23; prof_fnhash[i % (2 * PROF_MAXFNS)]; i++) {
+		f = &prof_fns[prof_fnhash[i % (2 * PROF_MAXFNS)] - 1];
+		if (f->pf_addr == info.eip_fn_addr)
+			return f - prof_fns;
+	}
+	if (prof_nfns == PROF_MAXFNS)
+		return -1;
+
+	f = &prof_fns[prof_nfns++];
+	f->pf_addr = info.eip_fn_addr;
+	f->pf_name = info.eip_fn_name;
+	f->pf_namelen = info.eip_fn_namelen;
+	f->pf_self = f->pf_total = 0;
+	f->pf_last = ~0U;
+	prof_fnhash[i % (2 * PROF_MAXFNS)] = prof_nfns;
+	return f - prof_fns;
+}
+
+// Symbolize sample 's', numbered 'id', into function indexes,
+// leaf first, charging each function once.  Returns the depth kept.
+static int
+prof_resolve(const struct ProfSample *s, uint32_t id, uint16_t *fns)
+{
+	int i, fn;
+
+	for (i = 0; i < s->ps_depth; i++) {
+		// Return addresses point past the call; look up the call.
+		if ((fn = prof_fn(s->ps_pc[i] - (i > 0))) < 0)
+			break;
+		fns[i] = fn;
+		if (i == 0)
+			prof_fns[fn].pf_self++;
+		if (prof_fns[fn].pf_last != id) {
+			prof_fns[fn].pf_last = id;
+			prof_fns[fn].pf_total++;
+		}
+	}
+	return i;
+}
+
+static void
+print_pct(uint32_t n, uint32_t total)
+{
+	uint32_t permille = total ? (uint64_t) n * 1000 / total : 0;
+
+	cprintf_fast("%3u.%u%% %6u", permille / 10, permille % 10, n);
+}
+
+static void
+profile_report(bool folded)
+{
+	static struct ProfStack stacks[PROF_MAXSTACKS];
+	static const struct ProfFn *sorted[PROF_MAXFNS];
+	const struct ProfSample *s;
+	struct ProfStack *k;
+	uint16_t fns[PROF_DEPTH];
+	uint32_t id = 0, total = 0, dropped = 0, lost = 0, h;
+	int cpu, i, j, depth, nstacks = 0;
+
+	prof_nfns = 0;
+	memset(prof_fnhash, 0, sizeof(prof_fnhash));
+
+	for (cpu = 0; cpu < PROF_NCPU; cpu++) {
+		total += prof_bufs[cpu].nsamples;
+		dropped += prof_bufs[cpu].dropped;
+		for (i = 0; i < prof_bufs[cpu].nsamples; i++, id++) {
+			s = &prof_bufs[cpu].samples[i];
+			if ((depth = prof_resolve(s, id, fns)) == 0) {
+				lost++;
+				continue;
+			}
+			if (!folded)
+				continue;
+
+			h = depth;
+			for (j = 0; j < depth; j++)
+				h = (h ^ fns[j]) * 16777619U;
+			for (k = stacks; k < stacks + nstacks; k++)
+				if (k->pk_hash == h && k->pk_depth == depth
+				    && memcmp(k->pk_fn, fns, depth * sizeof(fns[0])) == 0)
+					break;
+			if (k == stacks + PROF_MAXSTACKS) {
+				lost++;
+				continue;
+			}
+			if (k == stacks + nstacks) {
+				nstacks++;
+				memcpy(k->pk_fn, fns, sizeof(fns));
+				k->pk_depth = depth;
+				k->pk_hash = h;
+				k->pk_count = 0;
+			}
+			k->pk_count++;
+		}
+	}
+
+	cprintf("%u samples over %llu cycles, %u dropped, %u not shown\n",
+		total, (prof.on ? read_tsc() : prof.stop) - prof.start,
+		dropped, lost);
+	if (prof.npolled)
+		cprintf("%u samples were polled: only code that waits for console\n"
+			"input was sampled, and time spent elsewhere is not shown\n",
+			prof.npolled);
+
+	if (folded) {
+		// One line per distinct stack, root first, as flame graph
+		// tools expect.
+		for (k = stacks; k < stacks + nstacks; k++) {
+			for (j = k->pk_depth - 1; j >= 0; j--)
+				cprintf("%.*s%c", prof_fns[k->pk_fn[j]].pf_namelen,
+					prof_fns[k->pk_fn[j]].pf_name, j ? ';' : ' ');
+			cprintf("%u\n", k->pk_count);
+		}
+		return;
+	}
+
+	// Flat profile, busiest functions first.
+	for (i = 0; i < prof_nfns; i++) {
+		for (j = i; j > 0 && sorted[j - 1]->pf_self < prof_fns[i].pf_self; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = &prof_fns[i];
+	}
+	cprintf("%6s %6s  %6s %6s  %s\n", "self", "", "total", "", "function");
+	for (i = 0; i < prof_nfns; i++) {
+		print_pct(sorted[i]->pf_self, total);
+		cprintf("  ");
+		print_pct(sorted[i]->pf_total, total);
+		cprintf("  %.*s\n", sorted[i]->pf_namelen, sorted[i]->pf_name);
+	}
+}
+
+static int
+mon_profile(int argc, char **argv, struct Trapframe *tf)
+{
+	uint32_t samples = 0;
+	long usec = PROF_PERIOD_USEC;
+	int i;
+
+	if (argc >= 2 && strcmp(argv[1], "start") == 0) {
+		if (argc > 2 && (usec = strtol(argv[2], NULL, 0)) <= 0) {
+			cprintf("profile: bad period '%s'\n", argv[2]);
+			return 0;
+		}
+		profile_start(usec);
+	} else if (argc == 2 && strcmp(argv[1], "stop") == 0)
+		profile_stop();
+	else if (argc >= 2 && strcmp(argv[1], "report") == 0)
+		profile_report(argc > 2 && strcmp(argv[2], "folded") == 0);
+	else if (argc == 1) {
+		for (i = 0; i < PROF_NCPU; i++)
+			samples += prof_bufs[i].nsamples;
+		cprintf("profiling %s, %u samples\n", prof.on ? "on" : "off", samples);
+	} else
+		cprintf("Usage: profile [start [usec] | stop | report [folded]]\n");
+	return 0;
+}
+
+MONITOR_COMMAND("profile", "Sample kernel stacks (experimental): start [usec] | stop | report [folded]", mon_profile);
@@ -0,0 +1,29 @@
+#ifndef JOS_KERN_PROFILE_H
+#define JOS_KERN_PROFILE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Statistical kernel profiler.  While profiling is on, each sample
+// records the interrupted EIP and up to PROF_DEPTH - 1 return addresses
+// from the ebp chain into a per-CPU buffer; the monitor's "profile
+// report" symbolizes them into a flat profile or collapsed stacks.
+//
+// profile_tick() is meant to be called from the timer interrupt with
+// the interrupted eip and ebp.  Until the kernel takes timer interrupts,
+// profile_poll() samples its caller's stack once per period instead,
+// and is called from wherever the kernel polls for device input; code
+// that never polls, such as a long computation, is then never sampled.
+// The profiler is experimental until then, and its buffers are sized
+// for that: a few seconds of polled samples, not a real workload.
+
+#define PROF_NCPU	2		// Buffers; CPUs beyond this share them
+#define PROF_NSAMPLES	256		// Samples per CPU
+#define PROF_DEPTH	8		// Program counters per sample
+
+void profile_tick(uintptr_t eip, uintptr_t ebp);
+void profile_poll(void);
+
+#endif	// !JOS_KERN_PROFILE_H
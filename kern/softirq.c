@@ -0,0 +1,90 @@
+// Deferred interrupt work (bottom halves) and per-IRQ statistics.
+
+#include <inc/x86.h>
+#include <inc/stdio.h>
+#include <inc/assert.h>
+
+#include <kern/softirq.h>
+
+struct IrqStat irqstat[NIRQS];
+
+static struct {
+	void (*handler)(void);
+	int irq;			// For statistics
+	uint64_t raised;		// TSC when first raised since last run
+} softirqs[NSOFTIRQS];
+
+static volatile uint32_t softirq_pending;
+
+void
+softirq_register(int nr, int irq, void (*handler)(void))
+{
+	assert(nr >= 0 && nr < NSOFTIRQS);
+	assert(irq >= 0 && irq < NIRQS);
+	softirqs[nr].handler = handler;
+	softirqs[nr].irq = irq;
+}
+
+// Called from top halves, possibly with interrupts disabled:
+// must stay short.
+void
+softirq_raise(int nr)
+{
+	uint32_t bit = 1 << nr;
+
+	if (!(softirq_pending & bit))
+		softirqs[nr].raised = read_tsc();
+	asm volatile("lock; orl %1,%0" : "+m" (softirq_pending) : "r" (bit));
+}
+
+static int
+hist_bucket(uint64_t cycles)
+{
+	int b;
+
+	for (b = 0; b < IRQ_HIST_BUCKETS - 1 && (cycles >> (b + 1)); b++)
+		/* do nothing */;
+	return b;
+}
+
+// Run every pending bottom half.  Called wherever the kernel is about to
+// return to less urgent work: on trap return, or when polling for input.
+void
+softirq_run(void)
+{
+	uint32_t pending;
+	struct IrqStat *st;
+	int nr;
+
+	while (softirq_pending) {
+		pending = xchg(&softirq_pending, 0);
+		for (nr = 0; nr < NSOFTIRQS; nr++) {
+			if (!(pending & (1 << nr)) || !softirqs[nr].handler)
+				continue;
+			st = &irqstat[softirqs[nr].irq];
+			st->is_bh_runs++;
+			st->is_hist[hist_bucket(read_tsc() - softirqs[nr].raised)]++;
+			softirqs[nr].handler();
+		}
+	}
+}
+
+void
+irqstat_print(void)
+{
+	struct IrqStat *st;
+	int irq, b;
+
+	cprintf("irq     count     items     drops   bh-runs\n");
+	for (irq = 0; irq < NIRQS; irq++) {
+		st = &irqstat[irq];
+		if (!st->is_count && !st->is_bh_runs)
+			continue;
+		cprintf_fast("%3d  %8u  %8u  %8u  %8u\n", irq, st->is_count,
+			st->is_items, st->is_drops, st->is_bh_runs);
+		for (b = 0; b < IRQ_HIST_BUCKETS; b++)
+			if (st->is_hist[b])
+				cprintf_fast("     latency < 2^%2d cycles: %u\n",
+					b + 1, st->is_hist[b]);
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef JOS_KERN_SOFTIRQ_H
+#define JOS_KERN_SOFTIRQ_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Hardware IRQ numbers
+#define IRQ_KBD		1
+#define IRQ_SERIAL	4
+#define NIRQS		16
+
+// Deferred-work (bottom half) queues.  A device's interrupt handler (the
+// top half) only acknowledges the device, stashes raw data and raises its
+// softirq; the handler registered here does the rest later, with
+// interrupts enabled, from softirq_run().
+enum {
+	SOFTIRQ_KBD = 0,
+	SOFTIRQ_SERIAL,
+	NSOFTIRQS
+};
+
+// Raise-to-run latency histogram: bucket i counts bottom halves that
+// started between 2^i and 2^(i+1) TSC cycles after being raised.
+#define IRQ_HIST_BUCKETS	32
+
+struct IrqStat {
+	uint32_t is_count;		// Top-half invocations that found work
+	uint32_t is_items;		// Items queued for the bottom half
+	uint32_t is_drops;		// Items lost because the queue was full
+	uint32_t is_bh_runs;		// Bottom-half invocations
+	uint32_t is_hist[IRQ_HIST_BUCKETS];
+};
+
+extern struct IrqStat irqstat[NIRQS];
+
+void softirq_register(int nr, int irq, void (*handler)(void));
+void softirq_raise(int nr);
+void softirq_run(void);
+void irqstat_print(void);
+
+#endif	// !JOS_KERN_SOFTIRQ_H
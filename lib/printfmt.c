@@ -28,25 +28,157 @@ static const char * const error_string[MAXERROR] =
 	[E_FAULT]	= "segmentation fault",
 };
 
+// Return the message %e prints for error code 'err',
+// which may be positive or negative.
+const char *
+strerror(int err)
+{
+	if (err < 0)
+		err = -err;
+	if (err >= MAXERROR || error_string[err] == NULL)
+		return "unknown error";
+	return error_string[err];
+}
+
 /*
- * Print a number (base <= 16) in reverse order,
- * using specified putch function and associated pointer putdat.
+ * Output is collected in a small buffer on the caller's stack and handed
+ * to the sink's write function a chunk at a time, instead of calling
+ * a putch function for every character.
  */
+#define PRINTBUF_SIZE	128
+
+struct printbuf {
+	void (*write)(const char *, size_t, void *);
+	void *putdat;
+	int n;
+	char buf[PRINTBUF_SIZE];
+};
+
+static void
+pb_flush(struct printbuf *pb)
+{
+	if (pb->n > 0)
+		pb->write(pb->buf, pb->n, pb->putdat);
+	pb->n = 0;
+}
+
+static inline void
+pb_putc(int ch, struct printbuf *pb)
+{
+	if (pb->n == PRINTBUF_SIZE)
+		pb_flush(pb);
+	pb->buf[pb->n++] = ch;
+}
+
 static void
-printnum(void (*putch)(int, void*), void *putdat,
-	 unsigned long long num, unsigned base, int width, int padc)
+pb_write(const char *s, size_t len, struct printbuf *pb)
 {
-	// first recursively print all preceding (more significant) digits
-	if (num >= base) {
-		printnum(putch, putdat, num / base, base, width - 1, padc);
-	} else {
-		// print any needed pad characters before first digit
-		while (--width > 0)
-			putch(padc, putdat);
+	// Long runs go straight to the sink.
+	if (len > PRINTBUF_SIZE - pb->n) {
+		pb_flush(pb);
+		if (len >= PRINTBUF_SIZE) {
+			pb->write(s, len, pb->putdat);
+			return;
+		}
 	}
+	memcpy(pb->buf + pb->n, s, len);
+	pb->n += len;
+}
+
+static const char digits[] = "0123456789abcdef";
 
-	// then print this (the least significant) digit
-	putch("0123456789abcdef"[num % base], putdat);
+// Two-digit decimal strings "00" through "99", so that base-10
+// conversion needs one division per pair of digits.
+static const char digit_pairs[201] =
+	"00010203040506070809101112131415161718192021222324"
+	"25262728293031323334353637383940414243444546474849"
+	"50515253545556575859606162636465666768697071727374"
+	"75767778798081828384858687888990919293949596979899";
+
+// Store the decimal digits of n, least significant first, backwards
+// from p.  If ndigits is nonzero, zero-fill to exactly that many digits.
+static char *
+fmtdec32(char *p, uint32_t n, int ndigits)
+{
+	char *end = p;
+	uint32_t d;
+
+	while (n >= 100) {
+		d = (n % 100) * 2;
+		n /= 100;
+		*--p = digit_pairs[d + 1];
+		*--p = digit_pairs[d];
+	}
+	if (n >= 10) {
+		*--p = digit_pairs[n * 2 + 1];
+		*--p = digit_pairs[n * 2];
+	} else
+		*--p = '0' + n;
+	while (end - p < ndigits)
+		*--p = '0';
+	return p;
+}
+
+// Store the digits of num in base 'base' backwards from p,
+// returning a pointer to the most significant digit.
+// Only values that do not fit in 32 bits need 64-bit division,
+// and bases 8 and 16 need none at all.
+static char *
+fmtnum(char *p, unsigned long long num, unsigned base)
+{
+	uint32_t n;
+
+	if (base == 16) {
+		do {
+			*--p = digits[num & 15];
+			num >>= 4;
+		} while (num);
+		return p;
+	}
+	if (base == 8) {
+		do {
+			*--p = digits[num & 7];
+			num >>= 3;
+		} while (num);
+		return p;
+	}
+	if (base == 10) {
+		// Peel off nine digits at a time until the rest fits.
+		while (num > 0xFFFFFFFFULL) {
+			p = fmtdec32(p, num % 1000000000, 9);
+			num /= 1000000000;
+		}
+		return fmtdec32(p, num, 0);
+	}
+	while (num > 0xFFFFFFFFULL) {
+		*--p = digits[num % base];
+		num /= base;
+	}
+	n = num;
+	do {
+		*--p = digits[n % base];
+		n /= base;
+	} while (n);
+	return p;
+}
+
+/*
+ * Print a number (base <= 16) right-justified in a field of 'width'
+ * characters, padded on the left with padc, using specified printbuf.
+ */
+static void
+printnum(struct printbuf *pb, unsigned long long num, unsigned base,
+	 int width, int padc)
+{
+	char tmp[24];		// 22 octal digits for 2^64-1
+	char *end = tmp + sizeof(tmp);
+	char *p;
+
+	p = fmtnum(end, num, base);
+
+	for (width -= end - p; width > 0; width--)
+		pb_putc(padc, pb);
+	pb_write(p, end - p, pb);
 }
 
 // Get an unsigned int of various possible sizes from a varargs list,
@@ -76,169 +208,317 @@ getint(va_list *ap, int lflag)
 }
 
 
-// Main function to format and print a string.
-void printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
+static void pbprintfmt(struct printbuf *pb, const char *fmt, ...);
 
-void
-vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap)
+// Parse the flags, width, precision and conversion of one %-escape;
+// 'fmt' points just past the '%'.  Returns a pointer past the
+// conversion character, with d->conv 0 if it was not recognized.
+// A '*' takes its value from 'ap', or fails the parse if 'ap' is NULL.
+static const char *
+parse_spec(const char *fmt, struct printfmt_dir *d, va_list *ap)
+{
+	int ch, precision;
+
+	d->padc = ' ';
+	d->width = -1;
+	d->lflag = 0;
+	d->altflag = 0;
+	precision = -1;
+reswitch:
+	switch (ch = *(unsigned char *) fmt++) {
+
+	// flag to pad on the right
+	case '-':
+		d->padc = '-';
+		goto reswitch;
+
+	// flag to pad with 0's instead of spaces
+	case '0':
+		d->padc = '0';
+		goto reswitch;
+
+	// width field
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+	case '5':
+	case '6':
+	case '7':
+	case '8':
+	case '9':
+		for (precision = 0; ; ++fmt) {
+			precision = precision * 10 + ch - '0';
+			ch = *fmt;
+			if (ch < '0' || ch > '9')
+				break;
+		}
+		goto process_precision;
+
+	case '*':
+		if (ap == NULL)
+			return NULL;
+		precision = va_arg(*ap, int);
+		goto process_precision;
+
+	case '.':
+		if (d->width < 0)
+			d->width = 0;
+		goto reswitch;
+
+	case '#':
+		d->altflag = 1;
+		goto reswitch;
+
+	process_precision:
+		if (d->width < 0)
+			d->width = precision, precision = -1;
+		goto reswitch;
+
+	// long flag (doubled for long long)
+	case 'l':
+		d->lflag++;
+		goto reswitch;
+
+	case 'c':
+	case 'e':
+	case 's':
+	case 'd':
+	case 'u':
+	case 'o':
+	case 'p':
+	case 'x':
+	case '%':
+		d->conv = ch;
+		break;
+
+	default:
+		d->conv = '\0';
+		break;
+	}
+	d->precision = precision;
+	return fmt;
+}
+
+// Print one conversion described by 'd', taking its argument from 'ap'.
+static void
+print_spec(struct printbuf *pb, const struct printfmt_dir *d, va_list *ap)
 {
-	register const char *p;
-	register int ch, err;
+	const char *p;
+	int ch, err;
 	unsigned long long num;
-	int base, lflag, width, precision, altflag;
-	char padc;
+	int base, width = d->width, precision = d->precision;
+
+	switch (d->conv) {
+
+	// character
+	case 'c':
+		pb_putc(va_arg(*ap, int), pb);
+		break;
+
+	// error message
+	case 'e':
+		err = va_arg(*ap, int);
+		if (err < 0)
+			err = -err;
+		if (err >= MAXERROR || (p = error_string[err]) == NULL)
+			pbprintfmt(pb, "error %d", err);
+		else
+			pb_write(p, strlen(p), pb);
+		break;
+
+	// string
+	case 's':
+		if ((p = va_arg(*ap, char *)) == NULL)
+			p = "(null)";
+		if (width > 0 && d->padc != '-')
+			for (width -= strnlen(p, precision); width > 0; width--)
+				pb_putc(d->padc, pb);
+		for (; (ch = *p++) != '\0' && (precision < 0 || --precision >= 0); width--)
+			if (d->altflag && (ch < ' ' || ch > '~'))
+				pb_putc('?', pb);
+			else
+				pb_putc(ch, pb);
+		for (; width > 0; width--)
+			pb_putc(' ', pb);
+		break;
+
+	// (signed) decimal
+	case 'd':
+		num = getint(ap, d->lflag);
+		if ((long long) num < 0) {
+			pb_putc('-', pb);
+			num = -(long long) num;
+		}
+		base = 10;
+		goto number;
+
+	// unsigned decimal
+	case 'u':
+		num = getuint(ap, d->lflag);
+		base = 10;
+		goto number;
+
+	// (unsigned) octal
+	case 'o':
+		num = getuint(ap, d->lflag);
+		base = 8;
+		goto number;
+
+	// pointer
+	case 'p':
+		pb_putc('0', pb);
+		pb_putc('x', pb);
+		num = (unsigned long long)
+			(uintptr_t) va_arg(*ap, void *);
+		base = 16;
+		goto number;
+
+	// (unsigned) hexadecimal
+	case 'x':
+		num = getuint(ap, d->lflag);
+		base = 16;
+	number:
+		printnum(pb, num, base, width, d->padc);
+		break;
+
+	// escaped '%' character
+	case '%':
+		pb_putc('%', pb);
+		break;
+	}
+}
+
+// Main function to format and print a string.
+static void
+vpbprintfmt(struct printbuf *pb, const char *fmt, va_list ap)
+{
+	const char *p;
+	struct printfmt_dir d;
 
 	while (1) {
-		while ((ch = *(unsigned char *) fmt++) != '%') {
-			if (ch == '\0')
-				return;
-			putch(ch, putdat);
-		}
+		// copy the literal text up to the next '%' in one piece
+		for (p = fmt; *fmt != '%' && *fmt != '\0'; fmt++)
+			/* do nothing */;
+		if (fmt > p)
+			pb_write(p, fmt - p, pb);
+		if (*fmt == '\0')
+			return;
+		p = ++fmt;
 
 		// Process a %-escape sequence
-		padc = ' ';
-		width = -1;
-		precision = -1;
-		lflag = 0;
-		altflag = 0;
-	reswitch:
-		switch (ch = *(unsigned char *) fmt++) {
-
-		// flag to pad on the right
-		case '-':
-			padc = '-';
-			goto reswitch;
-
-		// flag to pad with 0's instead of spaces
-		case '0':
-			padc = '0';
-			goto reswitch;
-
-		// width field
-		case '1':
-		case '2':
-		case '3':
-		case '4':
-		case '5':
-		case '6':
-		case '7':
-		case '8':
-		case '9':
-			for (precision = 0; ; ++fmt) {
-				precision = precision * 10 + ch - '0';
-				ch = *fmt;
-				if (ch < '0' || ch > '9')
-					break;
-			}
-			goto process_precision;
-
-		case '*':
-			precision = va_arg(ap, int);
-			goto process_precision;
-
-		case '.':
-			if (width < 0)
-				width = 0;
-			goto reswitch;
-
-		case '#':
-			altflag = 1;
-			goto reswitch;
-
-		process_precision:
-			if (width < 0)
-				width = precision, precision = -1;
-			goto reswitch;
-
-		// long flag (doubled for long long)
-		case 'l':
-			lflag++;
-			goto reswitch;
-
-		// character
-		case 'c':
-			putch(va_arg(ap, int), putdat);
-			break;
+		fmt = parse_spec(fmt, &d, &ap);
+		if (d.conv)
+			print_spec(pb, &d, &ap);
+		else {
+			// unrecognized escape sequence - just print it literally
+			pb_putc('%', pb);
+			fmt = p;
+		}
+	}
+}
 
-		// error message
-		case 'e':
-			err = va_arg(ap, int);
-			if (err < 0)
-				err = -err;
-			if (err >= MAXERROR || (p = error_string[err]) == NULL)
-				printfmt(putch, putdat, "error %d", err);
-			else
-				printfmt(putch, putdat, "%s", p);
-			break;
+// Pre-parse 'fmt' into prog's directives, so that printing it again
+// skips the parse.  Formats that use '*', unrecognized escapes, or more
+// than PRINTFMT_MAXDIRS conversions are marked with ndirs = -1; callers
+// then print them with the ordinary routines.
+int
+printfmt_compile(struct printfmt_prog *prog, const char *fmt)
+{
+	struct printfmt_dir *d;
+	const char *p, *f = fmt;
+	int n = 0;
 
-		// string
-		case 's':
-			if ((p = va_arg(ap, char *)) == NULL)
-				p = "(null)";
-			if (width > 0 && padc != '-')
-				for (width -= strnlen(p, precision); width > 0; width--)
-					putch(padc, putdat);
-			for (; (ch = *p++) != '\0' && (precision < 0 || --precision >= 0); width--)
-				if (altflag && (ch < ' ' || ch > '~'))
-					putch('?', putdat);
-				else
-					putch(ch, putdat);
-			for (; width > 0; width--)
-				putch(' ', putdat);
+	while (1) {
+		if (n == PRINTFMT_MAXDIRS)
+			goto fail;
+		d = &prog->dirs[n++];
+		for (p = f; *f != '%' && *f != '\0'; f++)
+			/* do nothing */;
+		if (f - p > 0xFFFF)
+			goto fail;
+		d->lit = p;
+		d->litlen = f - p;
+		if (*f == '\0') {
+			d->conv = '\0';
 			break;
+		}
+		if ((f = parse_spec(f + 1, d, NULL)) == NULL || !d->conv)
+			goto fail;
+	}
+	prog->ndirs = n;
+	prog->fmt = fmt;
+	return 0;
+
+fail:
+	prog->ndirs = -1;
+	prog->fmt = fmt;
+	return -E_INVAL;
+}
 
-		// (signed) decimal
-		case 'd':
-			num = getint(&ap, lflag);
-			if ((long long) num < 0) {
-				putch('-', putdat);
-				num = -(long long) num;
-			}
-			base = 10;
-			goto number;
-
-		// unsigned decimal
-		case 'u':
-			num = getuint(&ap, lflag);
-			base = 10;
-			goto number;
-
-		// (unsigned) octal
-		case 'o':
-			num = getuint(&ap, lflag);
-			base = 8;
-			goto number;
-
-		// pointer
-		case 'p':
-			putch('0', putdat);
-			putch('x', putdat);
-			num = (unsigned long long)
-				(uintptr_t) va_arg(ap, void *);
-			base = 16;
-			goto number;
-
-		// (unsigned) hexadecimal
-		case 'x':
-			num = getuint(&ap, lflag);
-			base = 16;
-		number:
-			printnum(putch, putdat, num, base, width, padc);
-			break;
+// Print a compiled format to a bulk sink, like vwprintfmt.
+void
+vwprintfmt_prog(void (*write)(const char *, size_t, void*), void *putdat,
+		const struct printfmt_prog *prog, va_list ap)
+{
+	const struct printfmt_dir *d;
+	struct printbuf pb;
+
+	pb.write = write;
+	pb.putdat = putdat;
+	pb.n = 0;
+	for (d = prog->dirs; d < prog->dirs + prog->ndirs; d++) {
+		if (d->litlen)
+			pb_write(d->lit, d->litlen, &pb);
+		if (d->conv)
+			print_spec(&pb, d, &ap);
+	}
+	pb_flush(&pb);
+}
 
-		// escaped '%' character
-		case '%':
-			putch(ch, putdat);
-			break;
+static void
+pbprintfmt(struct printbuf *pb, const char *fmt, ...)
+{
+	va_list ap;
 
-		// unrecognized escape sequence - just print it literally
-		default:
-			putch('%', putdat);
-			for (fmt--; fmt[-1] != '%'; fmt--)
-				/* do nothing */;
-			break;
-		}
-	}
+	va_start(ap, fmt);
+	vpbprintfmt(pb, fmt, ap);
+	va_end(ap);
+}
+
+// Format to a bulk sink: 'write' receives the output in runs.
+void
+vwprintfmt(void (*write)(const char *, size_t, void*), void *putdat,
+	   const char *fmt, va_list ap)
+{
+	struct printbuf pb;
+
+	pb.write = write;
+	pb.putdat = putdat;
+	pb.n = 0;
+	vpbprintfmt(&pb, fmt, ap);
+	pb_flush(&pb);
+}
+
+// The per-character putch interface, as an adapter over vwprintfmt.
+struct putchbuf {
+	void (*putch)(int, void*);
+	void *putdat;
+};
+
+static void
+putchwrite(const char *s, size_t len, struct putchbuf *b)
+{
+	while (len-- > 0)
+		b->putch(*s++, b->putdat);
+}
+
+void
+vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap)
+{
+	struct putchbuf b = { putch, putdat };
+
+	vwprintfmt((void*)putchwrite, &b, fmt, ap);
 }
 
 void
@@ -258,11 +538,15 @@ struct sprintbuf {
 };
 
 static void
-sprintputch(int ch, struct sprintbuf *b)
+sprintwrite(const char *s, size_t len, struct sprintbuf *b)
 {
-	b->cnt++;
-	if (b->buf < b->ebuf)
-		*b->buf++ = ch;
+	size_t room = b->ebuf - b->buf;
+
+	b->cnt += len;
+	if (len > room)
+		len = room;
+	memcpy(b->buf, s, len);
+	b->buf += len;
 }
 
 int
@@ -274,7 +558,7 @@ vsnprintf(char *buf, int n, const char *fmt, va_list ap)
 		return -E_INVAL;
 
 	// print the string to the buffer
-	vprintfmt((void*)sprintputch, &b, fmt, ap);
+	vwprintfmt((void*)sprintwrite, &b, fmt, ap);
 
 	// null terminate the buffer
 	*b.buf = '\0';
@@ -17,7 +17,7 @@ readline(const char *prompt)
 	while (1) {
 		c = getchar();
 		if (c < 0) {
-			cprintf("read error: %e\n", c);
+			cprintf("read error: %s\n", strerror(c));
 			return NULL;
 		} else if ((c == '\b' || c == '\x7f') && i > 0) {
 			if (echoing)